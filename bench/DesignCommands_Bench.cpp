@@ -0,0 +1,1239 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Standalone timings for the module's formatting and parsing kernels. Only
+// built when DESIGNCOMMANDS_BENCH is defined, see the README.
+
+#ifdef DESIGNCOMMANDS_BENCH
+
+#include "DesignCommands_CaptureJournal.h"
+#include "DesignCommands_CaptureState.h"
+#include "DesignCommands_CreatureCommands.h"
+#include "DesignCommands_CreatureExport.h"
+#include "DesignCommands_CreatureRegistry.h"
+#include "DesignCommands_Format.h"
+#include "DesignCommands_LiquidScan.h"
+#include "DesignCommands_PositionCommands.h"
+#include "DesignCommands_Terrain.h"
+#include "DesignCommands_WorldScale.h"
+#include "DesignCommands_ZoneLines.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <list>
+#include <memory>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// The ostringstream versions the current kernels replaced, kept to compare against
+static string LegacyRoundVal(float value)
+{
+    float scale = 100000.0f;
+    float roundedValue;
+    if (value < numeric_limits<float>::epsilon() && value > -numeric_limits<float>::epsilon())
+        roundedValue = 0;
+    else
+        roundedValue = round((value + numeric_limits<float>::epsilon()) * scale) / scale;
+
+    ostringstream stream;
+    stream << fixed << setprecision(6) << roundedValue;
+    return stream.str();
+}
+
+static string LegacyRoundVals(float valueX, float valueY, float valueZ)
+{
+    ostringstream stream;
+    stream << LegacyRoundVal(valueX) << "f, " << LegacyRoundVal(valueY) << "f, " << LegacyRoundVal(valueZ) << "f";
+    return stream.str();
+}
+
+static void LegacyExtractCoordinateValues(wstring const& inputText, vector<float>& outValues)
+{
+    wregex floatRegex(L"(-?\\d+(?:\\.\\d+)?)");
+    wsregex_iterator floatRegexIterator(inputText.begin(), inputText.end(), floatRegex);
+    wsregex_iterator end;
+    while (floatRegexIterator != end)
+    {
+        wsmatch match = *floatRegexIterator;
+        try
+        {
+            outValues.push_back(stof(match.str()));
+        }
+        catch (invalid_argument const&) {}
+        ++floatRegexIterator;
+    }
+}
+
+class BenchCreature
+{
+public:
+    string Name;
+    string SubName;
+    uint32_t SpawnID;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+};
+
+// Keeps results observable so the optimizer cannot drop the work
+static size_t benchSink = 0;
+
+template <typename Work>
+static void RunBench(char const* benchName, size_t operationCount, Work&& work)
+{
+    auto startTime = chrono::steady_clock::now();
+    work();
+    double elapsedNanoseconds = double(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startTime).count());
+    printf("%-44s %12.1f ns/op %10.2f ms  (%zu ops)\n", benchName, elapsedNanoseconds / double(operationCount), elapsedNanoseconds / 1000000.0, operationCount);
+}
+
+static vector<BenchCreature> MakeCreatures(size_t creatureCount)
+{
+    static char const* const names[] = { "a_gnoll", "a_gnoll_pup", "Guard_Ruark", "a_large_rat", "Fippy_Darkpaw", "a_decaying_skeleton", "Captain_Tillin", "a_fire_beetle" };
+    static char const* const subNames[] = { "", "", "", "Guard", "Merchant", "Banker" };
+
+    mt19937 random(1234);
+    uniform_real_distribution<float> coordinate(-1500.0f, 1500.0f);
+    uniform_real_distribution<float> height(-80.0f, 120.0f);
+    vector<BenchCreature> creatures(creatureCount);
+    for (size_t i = 0; i < creatureCount; ++i)
+    {
+        creatures[i].Name = names[random() % 8];
+        creatures[i].SubName = subNames[random() % 6];
+        creatures[i].SpawnID = uint32_t(300000 + i);
+        creatures[i].PositionX = coordinate(random);
+        creatures[i].PositionY = coordinate(random);
+        creatures[i].PositionZ = height(random);
+    }
+    return creatures;
+}
+
+// Stand-ins for the engine calls the module logic is written against, see
+// DesignCommands_Terrain.h. The registry bench only needs the position and
+// spawn fields, the stub world below uses the rest.
+class CreatureTemplate
+{
+public:
+    string SubName;
+};
+
+class ObjectGuid
+{
+public:
+    uint64_t RawValue = 0;
+
+    uint64_t GetRawValue() const { return RawValue; }
+};
+
+class MotionMaster
+{
+public:
+    size_t FallCount = 0;
+
+    void MoveFall() { FallCount++; }
+};
+
+class Creature
+{
+public:
+    float PositionZ;
+    uint32_t SpawnID;
+    ObjectGuid GUID;
+    uint32_t MapID = 0;
+    uint32_t InstanceID = 0;
+    uint32_t Entry = 0;
+    bool IsSwimmer = false;
+    size_t HeartbeatCount = 0;
+    MotionMaster Motion;
+    float PositionX = 0;
+    float PositionY = 0;
+    float Orientation = 0;
+    string Name;
+    CreatureTemplate Template;
+
+    string const& GetName() const { return Name; }
+    CreatureTemplate const* GetCreatureTemplate() const { return &Template; }
+    uint32_t GetSpawnId() const { return SpawnID; }
+    ObjectGuid const& GetGUID() const { return GUID; }
+    uint32_t GetMapId() const { return MapID; }
+    uint32_t GetInstanceId() const { return InstanceID; }
+    uint32_t GetEntry() const { return Entry; }
+    bool CanSwim() const { return IsSwimmer; }
+    void SendMovementFlagUpdate() { HeartbeatCount++; }
+    MotionMaster* GetMotionMaster() { return &Motion; }
+    float GetPositionX() const { return PositionX; }
+    float GetPositionY() const { return PositionY; }
+    float GetPositionZ() const { return PositionZ; }
+    float GetOrientation() const { return Orientation; }
+
+    void SetPosition(float x, float y, float z, float o)
+    {
+        PositionX = x;
+        PositionY = y;
+        PositionZ = z;
+        Orientation = o;
+    }
+};
+
+// Rolling hills with a lake in one corner. Like Map::GetHeight, a probe from
+// below the ground finds nothing.
+class StubMap
+{
+public:
+    static constexpr float InvalidHeight = -100000.0f;
+    static constexpr float InvalidWaterLevel = -200000.0f;
+    static constexpr float LakeLevel = 4.0f;
+
+    float GetGroundHeight(float x, float y) const
+    {
+        return 20.0f * sin(x / 60.0f) * cos(y / 45.0f) + 0.01f * x;
+    }
+
+    float GetHeight(float x, float y, float z, bool /*checkVMap*/ = true, float /*maxSearchDist*/ = 50.0f) const
+    {
+        float groundHeight = GetGroundHeight(x, y);
+        return groundHeight <= z + 0.5f ? groundHeight : InvalidHeight;
+    }
+
+    float GetWaterLevel(float x, float y) const
+    {
+        return x < -200.0f && y < -200.0f ? LakeLevel : InvalidWaterLevel;
+    }
+};
+
+// The registry before it was split per map and per field
+class LegacyCreatureReference
+{
+public:
+    Creature* CreaturePtr;
+    uint32_t MapID;
+    uint32_t Entry;
+    string Name;
+    string SubName;
+};
+
+// Scans one map out of eight, first counting and then reading through the
+// creature pointer as the fall and export passes do
+static void RunRegistryBench(size_t entryCount)
+{
+    uint32_t const mapCount = 8;
+    mt19937 random(99);
+    uniform_real_distribution<float> coordinate(-3000.0f, 3000.0f);
+
+    // Allocate creatures and list nodes in shuffled order, the way spawns trickle in over time
+    vector<unique_ptr<Creature>> creatures(entryCount);
+    vector<size_t> spawnOrder(entryCount);
+    for (size_t i = 0; i < entryCount; ++i)
+        spawnOrder[i] = i;
+    shuffle(spawnOrder.begin(), spawnOrder.end(), random);
+
+    list<LegacyCreatureReference> legacyReferences;
+    CreatureRegistry registry;
+    for (size_t i : spawnOrder)
+    {
+        creatures[i] = make_unique<Creature>();
+        creatures[i]->PositionZ = coordinate(random);
+        creatures[i]->SpawnID = uint32_t(i);
+        uint32_t mapID = uint32_t(i % mapCount);
+        legacyReferences.push_back({ creatures[i].get(), mapID, uint32_t(i % 500), "a_gnoll", "" });
+
+        CreatureReference reference;
+        reference.GUID = i + 1;
+        reference.MapID = mapID;
+        reference.Entry = uint32_t(i % 500);
+        reference.SpawnID = uint32_t(i);
+        reference.PositionX = coordinate(random);
+        reference.PositionY = coordinate(random);
+        registry.Add(creatures[i].get(), reference);
+    }
+
+    size_t mapEntryCount = registry.CountInMap(3);
+    printf("\nRegistry layouts, %zu entries over %u maps\n", entryCount, mapCount);
+    RunBench("Map count (list<CreatureReference>)", mapEntryCount, [&]
+    {
+        size_t count = 0;
+        for (LegacyCreatureReference const& reference : legacyReferences)
+            if (reference.MapID == 3)
+                count++;
+        benchSink += count;
+    });
+    RunBench("Map count (per-field arrays)", mapEntryCount, [&]
+    {
+        size_t count = 0;
+        registry.ForEachCreatureInMap(3, [&count](Creature*) { count++; });
+        benchSink += count;
+    });
+    RunBench("Map scan via Creature* (list)", mapEntryCount, [&]
+    {
+        float heightSum = 0;
+        for (LegacyCreatureReference const& reference : legacyReferences)
+            if (reference.MapID == 3)
+                heightSum += reference.CreaturePtr->PositionZ;
+        benchSink += size_t(heightSum != 0);
+    });
+    RunBench("Map scan via Creature* (per-field arrays)", mapEntryCount, [&]
+    {
+        float heightSum = 0;
+        registry.ForEachCreatureInMap(3, [&heightSum](Creature* creature) { heightSum += creature->PositionZ; });
+        benchSink += size_t(heightSum != 0);
+    });
+    RunBench("Map scan with entry + spawn (list)", mapEntryCount, [&]
+    {
+        size_t checksum = 0;
+        for (LegacyCreatureReference const& reference : legacyReferences)
+            if (reference.MapID == 3)
+                checksum += reference.Entry + reference.CreaturePtr->SpawnID;
+        benchSink += checksum;
+    });
+    RunBench("Map scan with entry + spawn (per-field)", mapEntryCount, [&]
+    {
+        size_t checksum = 0;
+        registry.ForEachInMap(3, [&checksum](Creature* creature, CreatureReference const& reference) { checksum += reference.Entry + creature->SpawnID; });
+        benchSink += checksum;
+    });
+}
+
+static string ReadWholeFile(string const& fileName)
+{
+    ifstream inputFile(fileName.c_str(), ios::binary);
+    ostringstream stream;
+    stream << inputFile.rdbuf();
+    return stream.str();
+}
+
+static bool ReportCheck(char const* checkName, bool isPassed)
+{
+    printf("%-44s %s\n", checkName, isPassed ? "ok" : "MISMATCH");
+    return isPassed;
+}
+
+// Runs the fall, terrain and export paths on a synthetic map and creatures,
+// timing them and checking the export files against the formatting the module
+// used before the batch kernels. Returns false if any check fails.
+static bool RunStubWorld(size_t creatureCount, float worldScale)
+{
+    uint32_t const mapID = 9990;
+    static char const* const names[] = { "a_gnoll", "a_gnoll_pup", "Guard_Ruark", "a_large_rat", "Fippy_Darkpaw" };
+    static char const* const subNames[] = { "", "", "Guard", "Merchant" };
+
+    StubMap map;
+    mt19937 random(4321);
+    uniform_real_distribution<float> coordinate(-1500.0f, 1500.0f);
+    uniform_real_distribution<float> depth(0.0f, 12.0f);
+    vector<unique_ptr<Creature>> creatures(creatureCount);
+    for (size_t i = 0; i < creatureCount; ++i)
+    {
+        // Spawned up to 12 yards into the ground, as converted spawns often are
+        creatures[i] = make_unique<Creature>();
+        Creature& creature = *creatures[i];
+        creature.Name = names[i % 5];
+        creature.Template.SubName = subNames[i % 4];
+        creature.SpawnID = uint32_t(500000 + i);
+        creature.PositionX = coordinate(random);
+        creature.PositionY = coordinate(random);
+        creature.PositionZ = map.GetGroundHeight(creature.PositionX, creature.PositionY) - depth(random);
+        creature.Orientation = float(i % 628) / 100.0f;
+        creature.GUID.RawValue = i + 1;
+        creature.MapID = mapID;
+        creature.Entry = uint32_t(1000 + i % 50);
+    }
+
+    // Spawn through the hooks from a few map threads at once, as OnCreatureAddWorld does
+    CreatureRegistryFeed<Creature> feed;
+    size_t const mapThreadCount = 4;
+    vector<thread> mapThreads;
+    for (size_t threadIndex = 0; threadIndex < mapThreadCount; ++threadIndex)
+        mapThreads.emplace_back([&feed, &creatures, threadIndex, mapThreadCount]
+        {
+            for (size_t i = threadIndex; i < creatures.size(); i += mapThreadCount)
+                feed.OnAdd(creatures[i].get());
+        });
+    for (thread& mapThread : mapThreads)
+        mapThread.join();
+    CreatureRegistry& registry = feed.GetRegistry();
+
+    printf("\nStub world, %zu creatures\n", creatureCount);
+    bool isPassed = true;
+
+    size_t fedCount = 0;
+    registry.ForEachInMap(mapID, [&](Creature* creature, CreatureReference const& reference)
+    {
+        fedCount += reference.GUID == creature->GUID.RawValue && reference.Entry == creature->Entry && reference.SpawnID == creature->SpawnID;
+    });
+    isPassed &= ReportCheck("Spawn hooks feed every creature", fedCount == creatureCount);
+
+    // The command bodies, as .zonecreaturesnear and .zonecreaturesbox run them
+    OutputLog listOutput;
+    listOutput.Configure(16, 1000, true, [](string const&) {});
+    float badRadius = nanf("");
+    size_t listedCount = 0;
+    bool isBadRadiusRefused = !ListCreaturesNear(feed, listOutput, mapID, 0.0f, 0.0f, 10000.0f, badRadius, listedCount);
+    float radius = 300.0f;
+    size_t nearCount = 0;
+    ListCreaturesNear(feed, listOutput, mapID, 100.0f, -200.0f, 10000.0f, radius, nearCount);
+    size_t expectedNearCount = 0;
+    size_t expectedBoxCount = 0;
+    for (unique_ptr<Creature> const& creature : creatures)
+    {
+        float deltaX = creature->PositionX - 100.0f;
+        float deltaY = creature->PositionY + 200.0f;
+        expectedNearCount += deltaX * deltaX + deltaY * deltaY <= radius * radius;
+        expectedBoxCount += creature->PositionX >= -500.0f && creature->PositionX <= 250.0f && creature->PositionY >= -100.0f && creature->PositionY <= 700.0f;
+    }
+    size_t boxCount = 0;
+    bool isBoxListed = ListCreaturesInBox(feed, listOutput, mapID, 250.0f, 700.0f, -500.0f, -100.0f, boxCount);
+    isPassed &= ReportCheck("Near and box commands list the right spawns", isBadRadiusRefused && nearCount == expectedNearCount
+        && isBoxListed && boxCount == expectedBoxCount);
+
+    // The same GUID spawned in a second instance of the map, then despawned there
+    CreatureReference instanceReference;
+    instanceReference.GUID = 1;
+    instanceReference.MapID = mapID;
+    instanceReference.InstanceID = 7;
+    Creature instanceCreature = *creatures[0];
+    registry.Add(&instanceCreature, instanceReference);
+    bool isInstanceListed = registry.CountInMap(mapID) == creatureCount + 1;
+    registry.Remove(mapID, 7, 1);
+    size_t firstCreatureCount = 0;
+    registry.ForEachCreatureInMap(mapID, [&](Creature* creature) { firstCreatureCount += creature == creatures[0].get(); });
+    isPassed &= ReportCheck("Instance spawns leave other instances alone", isInstanceListed && firstCreatureCount == 1);
+
+    // A moved entry is found at its new position only, and out-of-range queries stay in bounds
+    CreatureReference movedReference;
+    movedReference.GUID = 1000000;
+    movedReference.MapID = mapID;
+    movedReference.PositionX = 5000.0f;
+    movedReference.PositionY = 5000.0f;
+    registry.Add(&instanceCreature, movedReference);
+    registry.MarkMoved(mapID, 0, movedReference.GUID, 7000.0f, -7000.0f);
+    size_t oldPlaceCount = 0;
+    size_t newPlaceCount = 0;
+    registry.ForEachInRadius(mapID, 5000.0f, 5000.0f, 1.0f, [&](Creature*, CreatureReference const&) { oldPlaceCount++; });
+    registry.ForEachInRadius(mapID, 7000.0f, -7000.0f, 1.0f, [&](Creature*, CreatureReference const&) { newPlaceCount++; });
+    size_t hugeRadiusCount = 0;
+    registry.ForEachInRadius(mapID, 0.0f, 0.0f, 1e30f, [&](Creature*, CreatureReference const&) { hugeRadiusCount++; });
+    registry.ForEachInBox(mapID, nanf(""), nanf(""), nanf(""), nanf(""), [&](Creature*, CreatureReference const&) { hugeRadiusCount++; });
+    registry.Remove(mapID, 0, movedReference.GUID);
+    isPassed &= ReportCheck("Moves rebucket, huge queries are bounded",
+        oldPlaceCount == 0 && newPlaceCount == 1 && hugeRadiusCount == creatureCount + 1);
+
+    // Changes read for a delta that could not be queued are still there for the next try
+    registry.ClearChangesInMap(mapID);
+    registry.MarkMoved(mapID, 0, 1, creatures[0]->PositionX, creatures[0]->PositionY);
+    registry.MarkMoved(mapID, 0, 2, creatures[1]->PositionX, creatures[1]->PositionY);
+    size_t firstReadCount = 0;
+    size_t secondReadCount = 0;
+    size_t clearedReadCount = 0;
+    vector<uint32_t> readRemovedSpawnIDs;
+    registry.ForEachChangeInMap(mapID, [&](Creature*, CreatureReference const&) { firstReadCount++; }, readRemovedSpawnIDs);
+    registry.ForEachChangeInMap(mapID, [&](Creature*, CreatureReference const&) { secondReadCount++; }, readRemovedSpawnIDs);
+    registry.ClearChangesInMap(mapID);
+    registry.ForEachChangeInMap(mapID, [&](Creature*, CreatureReference const&) { clearedReadCount++; }, readRemovedSpawnIDs);
+    isPassed &= ReportCheck("Changes stay tracked until cleared", firstReadCount == 2 && secondReadCount == 2 && clearedReadCount == 0);
+
+    // The delta command keeps its changes when the export queue is full
+    feed.OnMoved(creatures[0].get());
+    size_t changedCount = 0;
+    size_t removedCount = 0;
+    size_t queuedRowCount = 0;
+    CreatureDeltaQueueResult fullResult = QueueCreatureDelta(feed, mapID, [](vector<CreatureExportRow>&&, vector<uint32_t>&&) { return false; },
+        changedCount, removedCount);
+    CreatureDeltaQueueResult queuedResult = QueueCreatureDelta(feed, mapID, [&](vector<CreatureExportRow>&& changedRows, vector<uint32_t>&&)
+    {
+        queuedRowCount = changedRows.size();
+        return true;
+    }, changedCount, removedCount);
+    CreatureDeltaQueueResult emptyResult = QueueCreatureDelta(feed, mapID, [](vector<CreatureExportRow>&&, vector<uint32_t>&&) { return true; },
+        changedCount, removedCount);
+    isPassed &= ReportCheck("Delta command clears only once queued", fullResult == CREATURE_DELTA_QUEUE_FULL
+        && queuedResult == CREATURE_DELTA_QUEUED && queuedRowCount == 1 && emptyResult == CREATURE_DELTA_NO_CHANGES);
+
+    // A grid unloading and loading again is not a change
+    CreatureReference reloadedReference;
+    registry.ForEachInMap(mapID, [&](Creature*, CreatureReference const& reference) { if (reference.GUID == 3) reloadedReference = reference; });
+    registry.Remove(mapID, 0, 3);
+    registry.Add(creatures[2].get(), reloadedReference);
+    size_t reloadChangeCount = 0;
+    readRemovedSpawnIDs.clear();
+    registry.ForEachChangeInMap(mapID, [&](Creature*, CreatureReference const&) { reloadChangeCount++; }, readRemovedSpawnIDs);
+    isPassed &= ReportCheck("Grid reloads leave the delta empty", reloadChangeCount == 0 && readRemovedSpawnIDs.empty());
+
+    vector<float> spawnHeights(creatureCount);
+    for (size_t i = 0; i < creatureCount; ++i)
+        spawnHeights[i] = creatures[i]->PositionZ;
+
+    GroundHeightCache heightCache;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    RunBench("Fall step-up pass", creatureCount, [&]
+    {
+        registry.ForEachCreatureInMap(mapID, [&](Creature* creature) { StepUpOutOfGround(&map, heightCache, creature, hits, misses); });
+    });
+    // The cache shares a probe across a 2 x 2 x 2.5 yard cell, so a creature can end up that far off
+    size_t stuckCount = 0;
+    for (unique_ptr<Creature> const& creature : creatures)
+        if (map.GetHeight(creature->PositionX, creature->PositionY, creature->PositionZ + GroundHeightCache::CellSizeZ) < -10000)
+            stuckCount++;
+    isPassed &= ReportCheck("Fall step-up leaves no creature underground", stuckCount == 0);
+
+    // Snap the same spawns from where they started, every third one a swimmer
+    GroundSnapLog snapLog;
+    size_t snapIndex = 0;
+    size_t buriedCount = 0;
+    for (size_t i = 0; i < creatureCount; ++i)
+    {
+        creatures[i]->PositionZ = spawnHeights[i];
+        if (map.GetGroundHeight(creatures[i]->PositionX, creatures[i]->PositionY) - spawnHeights[i] >= 0.001f)
+            buriedCount++;
+    }
+    RunBench("Ground snap pass", creatureCount, [&]
+    {
+        registry.ForEachCreatureInMap(mapID, [&](Creature* creature)
+        {
+            GroundSnapRecord snapRecord;
+            if (SnapCreatureToGround(&map, creature, snapIndex++ % 3 == 0, snapRecord))
+            {
+                snapRecord.GUID = creature->SpawnID;
+                snapRecord.Entry = 0;
+                snapLog.Add(snapRecord);
+            }
+        });
+    });
+    size_t offGroundCount = 0;
+    for (unique_ptr<Creature> const& creature : creatures)
+    {
+        float groundHeight = map.GetGroundHeight(creature->PositionX, creature->PositionY);
+        float waterLevel = map.GetWaterLevel(creature->PositionX, creature->PositionY);
+        bool isInWater = creature->PositionZ > groundHeight && creature->PositionZ <= max(groundHeight, waterLevel);
+        // Spawns already within a thousandth of the ground are left alone
+        if (fabs(creature->PositionZ - groundHeight) >= 0.001f && !isInWater)
+            offGroundCount++;
+    }
+    isPassed &= ReportCheck("Ground snap lands on ground or in water", offGroundCount == 0);
+    vector<GroundSnapRecord> snapRecords = snapLog.Take();
+    string snapReport = FormatGroundSnapReport(mapID, worldScale, snapRecords);
+    isPassed &= ReportCheck("Ground snap logs each moved creature",
+        snapRecords.size() == buriedCount && size_t(count(snapReport.begin(), snapReport.end(), '\n')) == buriedCount + 1);
+
+    // Small jobs, where starting threads per call used to cost more than the work
+    WorkerPool workerPool;
+    workerPool.Configure(max<size_t>(4, GetDefaultWorkerCount()));
+    size_t const jobCount = 2000;
+    vector<uint64_t> jobItems(4096, 1);
+    atomic<uint64_t> pooledSum{ 0 };
+    RunBench("ParallelFor on the pool, 4096 items", jobCount, [&]
+    {
+        for (size_t job = 0; job < jobCount; ++job)
+            workerPool.ParallelFor(jobItems.size(), 256, [&](size_t begin, size_t end, size_t /*workerIndex*/)
+            {
+                uint64_t sum = 0;
+                for (size_t i = begin; i < end; ++i)
+                    sum += jobItems[i];
+                pooledSum += sum;
+            });
+    });
+    isPassed &= ReportCheck("Pooled ParallelFor covers every item once", pooledSum == jobCount * jobItems.size());
+
+    LiquidScanGrid grid;
+    grid.Width = 400;
+    grid.Height = 400;
+    grid.MinX = -1000.0f;
+    grid.MinY = -1000.0f;
+    grid.Step = 5.0f;
+    vector<LiquidPlane> planes;
+    RunBench("Terrain sample + liquid extract, 400 x 400", size_t(grid.Width) * grid.Height, [&]
+    {
+        TerrainGridSampler onePassSampler;
+        onePassSampler.Start(LiquidScanGrid(grid), 100000.0f, 533.3333f);
+        onePassSampler.Step(&map, workerPool, 0, 0);
+        grid = std::move(onePassSampler.GetGrid());
+        ExtractLiquidPlanes(grid, LiquidScanSettings(), planes);
+    });
+
+    // The same area a few grid lookups and one slice at a time, as map updates do it
+    TerrainGridSampler sampler;
+    sampler.Start(LiquidScanGrid(grid), 100000.0f, 533.3333f);
+    size_t stepCount = 0;
+    RunBench("Sliced terrain sample, 400 x 400", size_t(grid.Width) * grid.Height, [&]
+    {
+        while (!sampler.Step(&map, workerPool, 2, 0))
+            stepCount++;
+    });
+    isPassed &= ReportCheck("Sliced terrain sampling matches one pass", stepCount > 1
+        && sampler.GetGrid().GroundHeights == grid.GroundHeights && sampler.GetGrid().WaterLevels == grid.WaterLevels);
+    bool isLakeFound = false;
+    for (LiquidPlane const& plane : planes)
+        isLakeFound |= fabs(plane.topZ - StubMap::LakeLevel) < 0.01f && plane.seCornerX < -200.0f && plane.seCornerY < -200.0f;
+    isPassed &= ReportCheck("Liquid scan finds the lake", isLakeFound);
+
+    // Full export as .zonecreatureswrite both does it on the writer thread
+    vector<CreatureExportRow> exportRows;
+    registry.ForEachInMap(mapID, [&exportRows](Creature* creature, CreatureReference const& creatureReference)
+    {
+        exportRows.push_back(MakeCreatureExportRow(creature, creatureReference.Entry));
+    });
+    vector<CreatureExportRow> wowRows = exportRows;
+    OutputLog output;
+    output.Configure(16, 1000, false, [](string const&) {});
+    RunBench("Creature export (unscale, text, binary)", creatureCount, [&]
+    {
+        exportRows = wowRows;
+        UnscaleCreatureExportRows(exportRows, worldScale);
+        WriteCreatureTextExport(mapID, exportRows, output);
+        WriteCreatureBinaryExport(mapID, worldScale, exportRows);
+    });
+
+    string textFileName = to_string(mapID) + ".txt";
+    string exportedText = ReadWholeFile(textFileName);
+    string legacyText;
+    for (CreatureExportRow const& wowRow : wowRows)
+        legacyText += wowRow.Name + "," + wowRow.SubName + "," + LegacyRoundVal(wowRow.PositionZ / worldScale) + ",\n";
+    isPassed &= ReportCheck("Text export matches the legacy rows", exportedText == legacyText);
+
+    vector<CreatureExportRow> readRows;
+    float readWorldScale = 0;
+    bool isRead = ReadCreatureBinaryExport(to_string(mapID) + ".creatures.bin", readRows, readWorldScale);
+    bool isSame = isRead && readWorldScale == worldScale && readRows.size() == exportRows.size();
+    for (size_t rowIndex = 0; isSame && rowIndex < readRows.size(); ++rowIndex)
+    {
+        CreatureExportRow const& readRow = readRows[rowIndex];
+        CreatureExportRow const& exportRow = exportRows[rowIndex];
+        isSame = readRow.Name == exportRow.Name && readRow.SubName == exportRow.SubName && readRow.Entry == exportRow.Entry
+            && readRow.SpawnID == exportRow.SpawnID && readRow.PositionX == exportRow.PositionX && readRow.PositionY == exportRow.PositionY
+            && readRow.PositionZ == exportRow.PositionZ && readRow.Orientation == exportRow.Orientation;
+    }
+    isPassed &= ReportCheck("Binary export reads back exactly", isSame);
+
+    // Move and rename one creature (commas and a line break in the names) and
+    // drop another, then fold the delta into the base
+    vector<CreatureExportRow> changedRows = { exportRows[0] };
+    changedRows[0].PositionZ += 10.0f;
+    changedRows[0].Name = "Guard, Ruark \\ the\nBold";
+    changedRows[0].SubName = "Guard,";
+    vector<uint32_t> removedSpawnIDs = { exportRows[1].SpawnID };
+    AppendCreatureDeltaExport(mapID, removedSpawnIDs, changedRows);
+    CompactCreatureExport(mapID, output);
+    readRows.clear();
+    isRead = ReadCreatureBinaryExport(to_string(mapID) + ".creatures.bin", readRows, readWorldScale);
+    isPassed &= ReportCheck("Delta compaction applies changes", isRead && readRows.size() == exportRows.size() - 1
+        && readRows[0].PositionZ == changedRows[0].PositionZ && readRows[0].Name == changedRows[0].Name
+        && readRows[0].SubName == changedRows[0].SubName && readRows[1].SpawnID == exportRows[2].SpawnID);
+
+    // .npcup falls in place, .npcdown in snap mode lands on the ground and
+    // keeps the snap for .snapwrite, and .npcsnap reports what it did
+    vector<string> replies;
+    auto reply = [&replies](string const& text) { replies.push_back(text); };
+    vector<GroundSnapRecord> keptSnaps;
+    auto keepSnap = [&keptSnaps](GroundSnapRecord const& snapRecord) { keptSnaps.push_back(snapRecord); };
+    Creature& npc = *creatures[5];
+    registry.ClearChangesInMap(mapID);
+    size_t fallCount = npc.Motion.FallCount;
+    float raisedZ = npc.PositionZ + 3.0f;
+    DropCreature(feed, &map, &npc, 3.0f, false, keepSnap);
+    bool isFallen = npc.Motion.FallCount == fallCount + 1 && npc.PositionZ == raisedZ && keptSnaps.empty();
+    DropCreature(feed, &map, &npc, -20.0f, true, keepSnap);
+    float npcGroundHeight = map.GetGroundHeight(npc.PositionX, npc.PositionY);
+    bool isDropSnapped = keptSnaps.size() == 1 && keptSnaps[0].OldZ == raisedZ && keptSnaps[0].NewZ == npc.PositionZ
+        && keptSnaps[0].GUID == npc.GUID.RawValue && npc.PositionZ == npcGroundHeight && npc.HeartbeatCount == 1;
+    bool isNothingRefused = !SnapSelectedCreature(feed, &map, static_cast<Creature*>(nullptr), keepSnap, reply)
+        && replies.back() == "Select a creature to snap";
+    SnapSelectedCreature(feed, &map, &npc, keepSnap, reply);
+    bool isGroundedReported = replies.back() == npc.Name + " is already on the ground, or there is no ground under it";
+    npc.PositionZ -= 5.0f;
+    SnapSelectedCreature(feed, &map, &npc, keepSnap, reply);
+    bool isSnapReported = replies.back() == "Snapped " + npc.Name + " from z " + RoundVal(npcGroundHeight - 5.0f) + " to " + RoundVal(npcGroundHeight)
+        && keptSnaps.size() == 2;
+    isPassed &= ReportCheck("NPC up, down and snap", isFallen && isDropSnapped && isNothingRefused && isGroundedReported && isSnapReported
+        && registry.CountChangedInMap(mapID) == 1);
+    registry.ClearChangesInMap(mapID);
+
+    // .navaudit with the navmesh queries and the export writer stubbed out
+    replies.clear();
+    size_t auditedCount = 0;
+    function<string()> navAuditJob;
+    auto audit = [&auditedCount](vector<NavAuditSpawn> const& spawns, vector<NavAuditResult>& results)
+    {
+        auditedCount = spawns.size();
+        for (size_t i = 0; i < results.size(); ++i)
+            results[i] = { true, true, i % 2 ? 5.0f : 0.5f };
+        return true;
+    };
+    auto takeJob = [&navAuditJob](function<string()> writeJob)
+    {
+        navAuditJob = std::move(writeJob);
+        return true;
+    };
+    bool isNegativeRefused = !AuditCreatureNavMesh(feed, mapID, -1.0f, true, 4, audit, takeJob, reply)
+        && replies.back() == "The offset must not be negative";
+    bool isMissingMeshRefused = !AuditCreatureNavMesh(feed, mapID, nullopt, false, 4, audit, takeJob, reply)
+        && replies.back() == "No navmesh is loaded for map " + to_string(mapID);
+    bool isFullQueueRefused = !AuditCreatureNavMesh(feed, mapID, nullopt, true, 4, audit, [](function<string()>) { return false; }, reply)
+        && replies.back() == "Export queue is full, try again once the current exports finish";
+    bool isAudited = AuditCreatureNavMesh(feed, mapID, nullopt, true, 4, audit, takeJob, reply)
+        && replies.back().rfind("Audited " + to_string(registry.CountInMap(mapID)) + " spawns in ", 0) == 0;
+    string navAuditFileName = to_string(mapID) + ".navaudit.txt";
+    string navAuditMessage = navAuditJob ? navAuditJob() : "";
+    size_t halfCount = registry.CountInMap(mapID) / 2;
+    isPassed &= ReportCheck("Navmesh audit command", isNegativeRefused && isMissingMeshRefused && isFullQueueRefused && isAudited
+        && auditedCount == registry.CountInMap(mapID) && filesystem::exists(navAuditFileName)
+        && navAuditMessage.find(to_string(halfCount) + " off mesh") != string::npos);
+    remove(navAuditFileName.c_str());
+
+    remove(textFileName.c_str());
+    remove((to_string(mapID) + ".creatures.bin").c_str());
+    remove(GetCreatureDeltaFileName(mapID).c_str());
+    output.Stop();
+
+    // Design output through a ring far smaller than the dump, as .lpwrite and
+    // .zlwrite do with a long session, must arrive whole
+    OutputLog designOutput;
+    size_t receivedLineCount = 0;
+    bool isAnyDropped = false;
+    designOutput.Configure(16, 1000, false, [&](string const& block)
+    {
+        receivedLineCount += size_t(count(block.begin(), block.end(), '\n')) + 1;
+        isAnyDropped |= block.find("dropped") != string::npos;
+    });
+    size_t const designLineCount = 20000;
+    RunBench("Design output, 16 line ring", designLineCount, [&]
+    {
+        for (size_t i = 0; i < designLineCount; ++i)
+            designOutput.WriteOrWait(LiquidPlane().ToString());
+    });
+    designOutput.Stop();
+    isPassed &= ReportCheck("Design output drops nothing", receivedLineCount == designLineCount && !isAnyDropped);
+    return isPassed;
+}
+
+static bool IsSameLiquidPlane(LiquidPlane const& a, LiquidPlane const& b)
+{
+    return a.nwCornerX == b.nwCornerX && a.nwCornerY == b.nwCornerY && a.topZ == b.topZ && a.seCornerX == b.seCornerX
+        && a.seCornerY == b.seCornerY && a.bottomZ == b.bottomZ && a.slantType == b.slantType;
+}
+
+static bool IsSameCaptureState(CaptureState const& a, CaptureState const& b)
+{
+    if (a.LiquidPlanes.size() != b.LiquidPlanes.size() || a.ZoneLineCaptures.size() != b.ZoneLineCaptures.size())
+        return false;
+    if (!equal(a.LiquidPlanes.begin(), a.LiquidPlanes.end(), b.LiquidPlanes.begin(), IsSameLiquidPlane))
+        return false;
+    for (size_t i = 0; i < a.ZoneLineCaptures.size(); ++i)
+    {
+        ZoneLineCapture const& captureA = a.ZoneLineCaptures[i];
+        ZoneLineCapture const& captureB = b.ZoneLineCaptures[i];
+        if (captureA.PairIndex != captureB.PairIndex || captureA.PairName != captureB.PairName || captureA.PositionX != captureB.PositionX || captureA.PositionY != captureB.PositionY
+            || captureA.PositionZ != captureB.PositionZ)
+            return false;
+    }
+    return a.CurLiquidPlaneStep == b.CurLiquidPlaneStep && IsSameLiquidPlane(a.CurLiquidPlane, b.CurLiquidPlane)
+        && a.SelectedZoneLinePair == b.SelectedZoneLinePair && a.PendingDGPSText == b.PendingDGPSText;
+}
+
+// A long capture session written through the journal, then rebuilt from the
+// file, from a torn copy of it and from a checkpoint
+static bool RunCaptureJournal(size_t recordCount)
+{
+    vector<ZoneLinePairDefinition> zoneLinePairs;
+    ParseZoneLinePairTable(DefaultZoneLinePairTable, zoneLinePairs);
+    mt19937 random(777);
+    uniform_real_distribution<float> coordinate(-3000.0f, 3000.0f);
+    vector<CaptureRecord> records(recordCount);
+    for (size_t i = 0; i < recordCount; ++i)
+    {
+        CaptureRecord& record = records[i];
+        uint32_t kind = random() % 100;
+        for (float& value : record.Values)
+            value = coordinate(random);
+        if (kind < 55)
+            record.Type = CAPTURE_LIQUID_NODE;
+        else if (kind < 85)
+        {
+            record.Type = CAPTURE_ZONE_LINE;
+            record.Text = zoneLinePairs[random() % zoneLinePairs.size()].Name;
+        }
+        else if (kind < 95)
+        {
+            record.Type = CAPTURE_DGPS_POINT;
+            record.Text = RoundVal(record.Values[0]) + "|" + RoundVal(record.Values[1]) + "|" + RoundVal(record.Values[2]) + "|1.570000 scale:0.29";
+        }
+        else if (kind < 99)
+        {
+            record.Type = CAPTURE_ZONE_LINE_PAIR;
+            record.Text = zoneLinePairs[random() % zoneLinePairs.size()].Name;
+        }
+        else
+            record.Type = i % 2 ? CAPTURE_LIQUID_CLEAR : CAPTURE_ZONE_LINE_CLEAR;
+    }
+
+    // Ends on a capture for the pair the reload check drops, so a late clear
+    // cannot leave that check with nothing to drop
+    if (!records.empty())
+    {
+        records.back().Type = CAPTURE_ZONE_LINE;
+        records.back().Text = zoneLinePairs[0].Name;
+    }
+
+    printf("\nCapture journal, %zu records\n", recordCount);
+    bool isPassed = true;
+    string journalFileName = "designcommands_bench.journal";
+    remove(journalFileName.c_str());
+
+    CaptureState liveState;
+    CaptureJournal journal;
+    journal.Open(journalFileName, 0, CaptureJournalHeader, 5);
+    RunBench("Capture + journal append (group commit)", recordCount, [&]
+    {
+        for (CaptureRecord const& record : records)
+        {
+            ApplyCaptureRecord(liveState, zoneLinePairs, record);
+            journal.Append(FormatCaptureRecord(record));
+        }
+    });
+    journal.Stop();
+    CaptureJournalStats stats = journal.GetStats();
+    printf("%-44s %zu records in %zu syncs\n", "Journal flushes", size_t(stats.RecordsWritten), size_t(stats.Syncs));
+
+    // What the journal replaces, one write and sync per command
+    size_t syncedCount = min<size_t>(recordCount, 500);
+    FILE* syncedFile = fopen("designcommands_bench_synced.journal", "wb");
+    RunBench("Journal append, sync per record", syncedCount, [&]
+    {
+        for (size_t i = 0; i < syncedCount; ++i)
+        {
+            string line = FormatCaptureRecord(records[i]);
+            fwrite(line.data(), 1, line.size(), syncedFile);
+            fflush(syncedFile);
+            fsync(fileno(syncedFile));
+        }
+    });
+    fclose(syncedFile);
+    remove("designcommands_bench_synced.journal");
+
+    string journalText = ReadWholeFile(journalFileName);
+    CaptureState replayedState;
+    CaptureReplayStats replayStats;
+    RunBench("Journal replay", recordCount, [&]
+    {
+        ReplayCaptureJournal(journalText, zoneLinePairs, replayedState, replayStats);
+    });
+    isPassed &= ReportCheck("Journal replay rebuilds the session", stats.RecordsWritten == recordCount
+        && replayStats.AppliedCount == recordCount && replayStats.SkippedCount == 0 && IsSameCaptureState(liveState, replayedState));
+
+    // A crash halfway through writing the last record
+    string tornText = journalText + "zlcapture 12.5 -4";
+    CaptureState tornState;
+    CaptureReplayStats tornStats;
+    ReplayCaptureJournal(tornText, zoneLinePairs, tornState, tornStats);
+    isPassed &= ReportCheck("Torn journal tail is cut off", tornStats.ValidSize == journalText.size() && IsSameCaptureState(liveState, tornState));
+
+    string checkpoint;
+    RunBench("Checkpoint format", 1, [&]
+    {
+        checkpoint = FormatCaptureCheckpoint(liveState, zoneLinePairs);
+    });
+    journal.Open(journalFileName, journalText.size(), CaptureJournalHeader, 5);
+    bool isRewritten = journal.Rewrite(checkpoint);
+    journal.Stop();
+    CaptureState checkpointState;
+    CaptureReplayStats checkpointStats;
+    ReplayCaptureJournal(ReadWholeFile(journalFileName), zoneLinePairs, checkpointState, checkpointStats);
+    printf("%-44s %zu bytes down to %zu\n", "Checkpoint size", journalText.size(), checkpoint.size());
+    isPassed &= ReportCheck("Checkpoint rebuilds the session", isRewritten && IsSameCaptureState(liveState, checkpointState));
+
+    // A reloaded pair table in another order and without the first pair.
+    // Captures follow their pair by name, and a restart replays to the same list.
+    vector<ZoneLinePairDefinition> reloadedPairs(zoneLinePairs.rbegin(), zoneLinePairs.rend() - 1);
+    vector<ZoneLineCapture> remappedCaptures = liveState.ZoneLineCaptures;
+    size_t droppedCount = RemapZoneLineCaptures(reloadedPairs, remappedCaptures);
+    size_t expectedDropCount = size_t(count_if(liveState.ZoneLineCaptures.begin(), liveState.ZoneLineCaptures.end(),
+        [&](ZoneLineCapture const& capture) { return capture.PairName == zoneLinePairs[0].Name; }));
+    bool isRemapped = droppedCount == expectedDropCount && droppedCount > 0;
+    for (ZoneLineCapture const& capture : remappedCaptures)
+        isRemapped &= reloadedPairs[capture.PairIndex].Name == capture.PairName;
+    CaptureState reloadedState;
+    CaptureReplayStats reloadedStats;
+    ReplayCaptureJournal(ReadWholeFile(journalFileName), reloadedPairs, reloadedState, reloadedStats);
+    CaptureState remappedState = liveState;
+    remappedState.ZoneLineCaptures = remappedCaptures;
+    remappedState.SelectedZoneLinePair = reloadedState.SelectedZoneLinePair;
+    isPassed &= ReportCheck("Pair reload keeps captures by name", isRemapped && IsSameCaptureState(remappedState, reloadedState));
+
+    // A journal that is there but cannot be read must not be opened over,
+    // a missing one reads as empty and is created
+    string unreadableFileName = "designcommands_bench_unreadable.journal";
+    filesystem::create_directory(unreadableFileName);
+    string unreadableText;
+    bool isUnreadableRefused = !CaptureJournal::ReadFile(unreadableFileName, unreadableText);
+    filesystem::remove(unreadableFileName);
+    string missingText = "stale";
+    bool isMissingEmpty = CaptureJournal::ReadFile("designcommands_bench_missing.journal", missingText) && missingText.empty();
+    isPassed &= ReportCheck("Unreadable journal is refused", isUnreadableRefused && isMissingEmpty);
+
+    remove(journalFileName.c_str());
+    return isPassed;
+}
+
+class TeleportTarget
+{
+public:
+    uint32_t MapID;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+    float Orientation;
+
+    bool operator==(TeleportTarget const& other) const
+    {
+        return MapID == other.MapID && PositionX == other.PositionX && PositionY == other.PositionY && PositionZ == other.PositionZ
+            && Orientation == other.Orientation;
+    }
+};
+
+// Drives the .eqxyz, .dgps, .sgps, .lpcapture and .zl* command bodies as the
+// chat handlers do, with the replies and teleports recorded instead of sent
+static bool RunPositionCommands()
+{
+    printf("\nPosition commands\n");
+    bool isPassed = true;
+
+    vector<string> replies;
+    auto reply = [&replies](string const& text) { replies.push_back(text); };
+    vector<TeleportTarget> teleports;
+    auto teleport = [&teleports](uint32_t mapID, float x, float y, float z, float orientation)
+    {
+        teleports.push_back({ mapID, x, y, z, orientation });
+        return true;
+    };
+
+    // The GM stands on map 0 facing 1.5. Map 999 does not exist, and the
+    // surface is 12 yards up everywhere else.
+    WorldScaleTable worldScales;
+    worldScales.Load(0.5f, "30:0.25");
+    uint32_t const currentMapID = 0;
+    float const currentOrientation = 1.5f;
+    size_t surfaceLookupCount = 0;
+    auto goToTuple = [&](vector<float> const& locationValues)
+    {
+        return TeleportToEQCoordinates(locationValues, currentMapID, currentOrientation, worldScales,
+            [&reply](uint32_t mapID, float, float)
+            {
+                if (mapID != 999)
+                    return true;
+                reply("Invalid map");
+                return false;
+            },
+            [&surfaceLookupCount](uint32_t, float, float)
+            {
+                surfaceLookupCount++;
+                return 12.0f;
+            },
+            teleport);
+    };
+
+    unordered_map<uint64_t, EQSurveyList> surveyLists;
+    bool isSingleTeleported = RunEQXYZ("100, -40", surveyLists, 7, reply, goToTuple) && surveyLists.empty() && surfaceLookupCount == 1
+        && teleports.back() == TeleportTarget{ 0, 50.0f, -20.0f, 6.0f, 1.5f };
+    bool isSurveyLoaded = RunEQXYZ("4 8 12 30 0.5; 40 80 120 30\n-4 -8", surveyLists, 7, reply, goToTuple)
+        && replies.back() == "Loaded 3 survey points, going to point 1" && teleports.back() == TeleportTarget{ 30, 1.0f, 2.0f, 3.0f, 0.5f };
+    bool isSurveyStepped = StepEQSurvey(surveyLists, 7, 1, reply, goToTuple) && replies.back() == "Survey point 2 of 3"
+        && teleports.back() == TeleportTarget{ 30, 10.0f, 20.0f, 30.0f, 1.5f };
+    isSurveyStepped &= StepEQSurvey(surveyLists, 7, 1, reply, goToTuple) && replies.back() == "Survey point 3 of 3"
+        && teleports.back() == TeleportTarget{ 0, -2.0f, -4.0f, 6.0f, 1.5f };
+    size_t teleportCount = teleports.size();
+    bool isEndKept = !StepEQSurvey(surveyLists, 7, 1, reply, goToTuple) && replies.back() == "Already at survey point 3 of 3"
+        && StepEQSurvey(surveyLists, 7, -1, reply, goToTuple) && replies.back() == "Survey point 2 of 3" && teleports.size() == teleportCount + 1;
+    bool isBadInputRefused = !StepEQSurvey(surveyLists, 8, 1, reply, goToTuple)
+        && replies.back() == "No survey list loaded, paste several ';' separated coordinates into .eqxyz first"
+        && !RunEQXYZ("no numbers here", surveyLists, 7, reply, goToTuple) && !RunEQXYZ("5", surveyLists, 7, reply, goToTuple)
+        && !RunEQXYZ("1 2 3 999", surveyLists, 7, reply, goToTuple) && replies.back() == "Invalid map"
+        && teleports.size() == teleportCount + 1;
+    isPassed &= ReportCheck("EQ teleports and survey stepping", isSingleTeleported && isSurveyLoaded && isSurveyStepped && isEndKept
+        && isBadInputRefused);
+
+    // Captures go through the journal, and a replay must land on the same state
+    vector<ZoneLinePairDefinition> zoneLinePairs;
+    ParseZoneLinePairTable(DefaultZoneLinePairTable, zoneLinePairs);
+    string journalFileName = "designcommands_bench_commands.journal";
+    remove(journalFileName.c_str());
+    CaptureJournal journal;
+    journal.Open(journalFileName, 0, CaptureJournalHeader, 5);
+    CaptureState state;
+    OutputLog output;
+    output.Configure(16, 1000, false, [](string const&) {});
+
+    replies.clear();
+    CaptureDGPSPoint(state, journal, output, 0.25f, 25.0f, 50.0f, -75.0f, 1.5f, reply);
+    CaptureDGPSPoint(state, journal, output, 0.25f, 1.0f, 2.0f, 3.0f, 0.0f, reply);
+    string firstPointText = RoundVal(100.0f) + "|" + RoundVal(200.0f) + "|" + RoundVal(-300.0f) + "|" + RoundVal(1.5f) + " scale:0.25";
+    string secondPointText = RoundVal(4.0f) + "|" + RoundVal(8.0f) + "|" + RoundVal(12.0f) + "|" + RoundVal(0.0f) + " scale:0.25";
+    bool isDGPSShown = replies.size() == 2 && replies[0] == firstPointText && replies[1] == firstPointText + "|" + secondPointText
+        && state.PendingDGPSText.empty();
+
+    ReportSGPSPoint(output, 4321, 0.5f, 10.0f, -20.0f, 30.0f, reply);
+    bool isSGPSShown = replies.back() == "4321|" + RoundVal(20.0f) + "|" + RoundVal(-40.0f) + "|" + RoundVal(60.0f);
+
+    replies.clear();
+    for (int node = 0; node < 5; ++node)
+        CaptureLiquidPlaneNode(state, journal, output, float(node * 10), float(node * 20), float(node), reply);
+    bool isLiquidPlaneWalked = replies.size() == 6 && replies[0] == "Starting new liquid plane, begining with south and low"
+        && replies[4] == "Captured north and high height for current plane, south and low for next plane. Next is west."
+        && replies[5] == "Captured west, next is east" && state.LiquidPlanes.size() == 1 && state.CurLiquidPlaneStep == STEP_2_EAST;
+
+    vector<ZoneLinePairDefinition> noPairs;
+    bool isZoneLineCaptured = !CaptureZoneLine(state, journal, noPairs, 1.0f, 2.0f, 3.0f, reply) && replies.back() == "No zone line pairs are loaded";
+    state.SelectedZoneLinePair = 1;
+    JournalCapture(journal, CAPTURE_ZONE_LINE_PAIR, {}, zoneLinePairs[1].Name);
+    isZoneLineCaptured &= CaptureZoneLine(state, journal, zoneLinePairs, 1.0f, 2.0f, 3.0f, reply)
+        && CaptureZoneLine(state, journal, zoneLinePairs, 4.0f, 5.0f, 6.0f, reply)
+        && replies.back() == "Captured zone line 2 for " + zoneLinePairs[1].Name && state.ZoneLineCaptures.size() == 2
+        && state.ZoneLineCaptures[1].PairIndex == 1 && state.ZoneLineCaptures[1].PairName == zoneLinePairs[1].Name;
+
+    teleports.clear();
+    bool isZoneLineStepped = StepZoneLineHigh(30, 100.0f, 200.0f, 10.0f, 0.5f, teleport) && StepZoneLineLow(30, 100.0f, 200.0f, 10.0f, 0.5f, teleport)
+        && teleports.size() == 2 && teleports[0] == TeleportTarget{ 30, 120.0f, 200.0f, 40.0f, 0.5f }
+        && teleports[1] == TeleportTarget{ 30, 100.0f, 180.0f, 10.0f, 0.5f };
+
+    journal.Stop();
+    output.Stop();
+    CaptureState replayedState;
+    CaptureReplayStats replayStats;
+    ReplayCaptureJournal(ReadWholeFile(journalFileName), zoneLinePairs, replayedState, replayStats);
+    remove(journalFileName.c_str());
+    isPassed &= ReportCheck("Capture commands reply and journal", isDGPSShown && isSGPSShown && isLiquidPlaneWalked && isZoneLineCaptured
+        && replayStats.SkippedCount == 0 && IsSameCaptureState(state, replayedState));
+    isPassed &= ReportCheck("Zone line steps", isZoneLineStepped);
+    return isPassed;
+}
+
+int main(int argc, char** argv)
+{
+    size_t creatureCount = argc > 1 ? size_t(strtoull(argv[1], nullptr, 10)) : 100000;
+    size_t zoneLineCaptureCount = argc > 2 ? size_t(strtoull(argv[2], nullptr, 10)) : 2000;
+    vector<BenchCreature> creatures = MakeCreatures(creatureCount);
+    float const worldScale = 0.29f;
+
+    printf("%zu creatures, %zu zone line captures\n\n", creatureCount, zoneLineCaptureCount);
+
+    RunBench("RoundVal (ostringstream)", creatureCount * 3, [&]
+    {
+        for (BenchCreature const& creature : creatures)
+            benchSink += LegacyRoundVal(creature.PositionX).size() + LegacyRoundVal(creature.PositionY).size() + LegacyRoundVal(creature.PositionZ).size();
+    });
+    RunBench("FormatRoundVal (to_chars)", creatureCount * 3, [&]
+    {
+        char buffer[RoundValBufferSize];
+        for (BenchCreature const& creature : creatures)
+            benchSink += FormatRoundVal(buffer, sizeof(buffer), creature.PositionX) + FormatRoundVal(buffer, sizeof(buffer), creature.PositionY)
+                + FormatRoundVal(buffer, sizeof(buffer), creature.PositionZ);
+    });
+
+    RunBench("RoundVals (ostringstream)", creatureCount, [&]
+    {
+        for (BenchCreature const& creature : creatures)
+            benchSink += LegacyRoundVals(creature.PositionX, creature.PositionY, creature.PositionZ).size();
+    });
+    RunBench("AppendRoundVals", creatureCount, [&]
+    {
+        string output;
+        for (BenchCreature const& creature : creatures)
+        {
+            output.clear();
+            AppendRoundVals(output, creature.PositionX, creature.PositionY, creature.PositionZ);
+            benchSink += output.size();
+        }
+    });
+
+    RunBench("ConvertNumberToString", creatureCount, [&]
+    {
+        for (BenchCreature const& creature : creatures)
+            benchSink += ConvertNumberToString(creature.SpawnID).size();
+    });
+
+    RunBench("Creature text rows (concat + RoundVal)", creatureCount, [&]
+    {
+        vector<string> outputLines;
+        outputLines.reserve(creatures.size());
+        for (BenchCreature const& creature : creatures)
+            outputLines.push_back(creature.Name + "," + creature.SubName + "," + LegacyRoundVal(creature.PositionZ / worldScale) + ",");
+        benchSink += outputLines.size();
+    });
+    RunBench("Creature text rows (AppendRoundVal)", creatureCount, [&]
+    {
+        vector<string> outputLines;
+        outputLines.reserve(creatures.size());
+        for (BenchCreature const& creature : creatures)
+        {
+            string outputLine;
+            outputLine.reserve(creature.Name.size() + creature.SubName.size() + RoundValBufferSize + 3);
+            outputLine += creature.Name;
+            outputLine += ',';
+            outputLine += creature.SubName;
+            outputLine += ',';
+            AppendRoundVal(outputLine, creature.PositionZ / worldScale);
+            outputLine += ',';
+            outputLines.push_back(std::move(outputLine));
+        }
+        benchSink += outputLines.size();
+    });
+
+    vector<string> coordinateInputs;
+    vector<wstring> wideCoordinateInputs;
+    coordinateInputs.reserve(creatures.size());
+    wideCoordinateInputs.reserve(creatures.size());
+    for (BenchCreature const& creature : creatures)
+    {
+        ostringstream stream;
+        stream << fixed << setprecision(2) << creature.PositionX << " " << creature.PositionY << " " << creature.PositionZ << " 30 " << 1.5f;
+        coordinateInputs.push_back(stream.str());
+        wideCoordinateInputs.emplace_back(coordinateInputs.back().begin(), coordinateInputs.back().end());
+    }
+    RunBench("eqxyz coordinates (wregex + stof)", creatureCount, [&]
+    {
+        vector<float> locationValues;
+        for (wstring const& coordinateInput : wideCoordinateInputs)
+        {
+            locationValues.clear();
+            LegacyExtractCoordinateValues(coordinateInput, locationValues);
+            benchSink += locationValues.size();
+        }
+    });
+    RunBench("eqxyz coordinates (ParseCoordinateValues)", creatureCount, [&]
+    {
+        vector<float> locationValues;
+        for (string const& coordinateInput : coordinateInputs)
+        {
+            locationValues.clear();
+            ParseCoordinateValues(coordinateInput, locationValues);
+            benchSink += locationValues.size();
+        }
+    });
+
+    string surveyInput;
+    for (size_t i = 0; i < min<size_t>(coordinateInputs.size(), 1000); ++i)
+        surveyInput += coordinateInputs[i] + ";";
+    RunBench("eqxyz survey list of 1000 (ParseCoordinateTuples)", 1, [&]
+    {
+        vector<vector<float>> coordinateTuples;
+        ParseCoordinateTuples(surveyInput, coordinateTuples);
+        benchSink += coordinateTuples.size();
+    });
+
+    RunBench("Zone line capture (stream accumulate)", zoneLineCaptureCount, [&]
+    {
+        string thisZoneLineCoordinates;
+        string otherZoneLineCoordinates;
+        for (size_t i = 0; i < zoneLineCaptureCount; ++i)
+        {
+            BenchCreature const& creature = creatures[i % creatures.size()];
+            float otherZoneX = -310.758850f;
+            float otherZoneY = creature.PositionY + 0.439697f;
+            float otherZoneZ = -7.843740f;
+            ostringstream thisZoneLineStream;
+            thisZoneLineStream << thisZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"qeytoqrg\", " + LegacyRoundVals(otherZoneX, otherZoneY, otherZoneZ)
+                + ", ZoneLineOrientationType.North, " + LegacyRoundVals(creature.PositionX + 50.0f, creature.PositionY + 10.0f, 200.0f) + ", "
+                + LegacyRoundVals(creature.PositionX + 20.0f, creature.PositionY - 10.0f, -100.0f) + "); \n";
+            thisZoneLineCoordinates = thisZoneLineStream.str();
+            ostringstream otherZoneLineStream;
+            otherZoneLineStream << otherZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"qeynos2\", " + LegacyRoundVals(creature.PositionX, creature.PositionY, creature.PositionZ)
+                + ", ZoneLineOrientationType.South, " + LegacyRoundVals(otherZoneX - 20.0f, otherZoneY + 10.0f, 0) + ", "
+                + LegacyRoundVals(otherZoneX - 50.0f, otherZoneY - 10.0f, 0) + "); \n";
+            otherZoneLineCoordinates = otherZoneLineStream.str();
+        }
+        benchSink += thisZoneLineCoordinates.size() + otherZoneLineCoordinates.size();
+    });
+
+    vector<ZoneLinePairDefinition> zoneLinePairs;
+    ParseZoneLinePairTable(DefaultZoneLinePairTable, zoneLinePairs);
+    RunBench("Zone line capture (records + one-pass render)", zoneLineCaptureCount, [&]
+    {
+        vector<ZoneLineCapture> zoneLineCaptures;
+        zoneLineCaptures.reserve(1024);
+        for (size_t i = 0; i < zoneLineCaptureCount; ++i)
+        {
+            BenchCreature const& creature = creatures[i % creatures.size()];
+            zoneLineCaptures.push_back({ 0, creature.PositionX, creature.PositionY, creature.PositionZ, zoneLinePairs[0].Name });
+        }
+        vector<ZoneLineBlock> zoneLineBlocks;
+        RenderZoneLineCaptures(zoneLinePairs, zoneLineCaptures, zoneLineBlocks);
+        benchSink += zoneLineBlocks[0].ThisZoneLines.size() + zoneLineBlocks[0].OtherZoneLines.size();
+    });
+
+    CoordinateBatch wowPositions;
+    wowPositions.Resize(creatures.size());
+    for (size_t i = 0; i < creatures.size(); ++i)
+    {
+        wowPositions.X[i] = creatures[i].PositionX;
+        wowPositions.Y[i] = creatures[i].PositionY;
+        wowPositions.Z[i] = creatures[i].PositionZ;
+        wowPositions.O[i] = float(i % 628) / 100.0f;
+    }
+    CoordinateBatch eqPositions = wowPositions;
+    RunBench("Unscale + round xyzo (scalar)", creatureCount, [&]
+    {
+        for (size_t i = 0; i < wowPositions.Size(); ++i)
+        {
+            eqPositions.X[i] = RoundValue(wowPositions.X[i] / worldScale);
+            eqPositions.Y[i] = RoundValue(wowPositions.Y[i] / worldScale);
+            eqPositions.Z[i] = RoundValue(wowPositions.Z[i] / worldScale);
+            eqPositions.O[i] = RoundValue(wowPositions.O[i]);
+        }
+        benchSink += size_t(eqPositions.Z.back());
+    });
+    RunBench("Unscale + round xyzo (batch kernel)", creatureCount, [&]
+    {
+        eqPositions = wowPositions;
+        UnscaleCoordinateBatch(eqPositions, worldScale, true);
+        benchSink += size_t(eqPositions.Z.back());
+    });
+
+    vector<string> outputLines;
+    outputLines.reserve(creatures.size());
+    for (BenchCreature const& creature : creatures)
+        outputLines.push_back(creature.Name + "," + creature.SubName + "," + RoundVal(creature.PositionZ / worldScale) + ",");
+    char const* outputFileName = "designcommands_bench_output.txt";
+    RunBench("OutputFile::WriteLines", creatureCount, [&]
+    {
+        OutputFile outputFile;
+        outputFile.WriteLines(outputFileName, outputLines);
+    });
+    remove(outputFileName);
+
+    RunRegistryBench(100000);
+    RunRegistryBench(1000000);
+
+    bool isPassed = RunStubWorld(creatureCount, worldScale);
+    isPassed &= RunCaptureJournal(zoneLineCaptureCount * 10);
+    isPassed &= RunPositionCommands();
+
+    printf("\n(sink %zu)\n", benchSink);
+    return isPassed ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_BACKGROUNDWRITER_H
+#define DESIGNCOMMANDS_BACKGROUNDWRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs export jobs (formatting plus file I/O) on a single thread of its own so
+// that the world thread only pays for taking a snapshot. Jobs return the
+// message for whoever asked for them, which is handed back through
+// PollCompletions() so that it can be delivered from the world thread.
+class BackgroundWriter
+{
+public:
+    struct Completion
+    {
+        uint64_t RequesterGUID;
+        std::string Message;
+    };
+
+    explicit BackgroundWriter(size_t maxQueuedJobs) : maxQueuedJobs(maxQueuedJobs) {}
+
+    ~BackgroundWriter()
+    {
+        Stop();
+    }
+
+    // Returns false without queueing when the queue is full
+    bool TryEnqueue(uint64_t requesterGUID, std::function<std::string()> work)
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (isStopping || jobs.size() >= maxQueuedJobs)
+            return false;
+        if (!workerThread.joinable())
+            workerThread = std::thread(&BackgroundWriter::Run, this);
+        jobs.push_back({ requesterGUID, std::move(work) });
+        jobCondition.notify_one();
+        return true;
+    }
+
+    void PollCompletions(std::vector<Completion>& outCompletions)
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        for (Completion& completion : completions)
+            outCompletions.push_back(std::move(completion));
+        completions.clear();
+    }
+
+    // Finishes whatever is already queued, then joins the thread
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            isStopping = true;
+            jobCondition.notify_one();
+        }
+        if (workerThread.joinable())
+            workerThread.join();
+    }
+
+private:
+    struct Job
+    {
+        uint64_t RequesterGUID;
+        std::function<std::string()> Work;
+    };
+
+    void Run()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobCondition.wait(lock, [this] { return isStopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            std::string message = job.Work();
+
+            std::lock_guard<std::mutex> lock(completionMutex);
+            completions.push_back({ job.RequesterGUID, std::move(message) });
+        }
+    }
+
+    size_t maxQueuedJobs;
+    bool isStopping = false;
+    std::thread workerThread;
+
+    std::mutex jobMutex;
+    std::condition_variable jobCondition;
+    std::deque<Job> jobs;
+
+    std::mutex completionMutex;
+    std::vector<Completion> completions;
+};
+
+#endif
@@ -0,0 +1,278 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_CAPTUREJOURNAL_H
+#define DESIGNCOMMANDS_CAPTUREJOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+class CaptureJournalStats
+{
+public:
+    uint64_t RecordsWritten = 0;
+    uint64_t Syncs = 0;
+    size_t PendingCount = 0;
+    bool IsFailed = false;
+};
+
+// Append-only file of capture records with group commit. Append queues the
+// record and returns, and a thread of its own writes everything queued once
+// per flush interval with a single write and sync, so a burst of commands
+// costs one fsync and a crash loses at most one interval of captures. The
+// file is only ever appended to, except by Rewrite, which replaces it whole.
+class CaptureJournal
+{
+public:
+    CaptureJournal() = default;
+
+    ~CaptureJournal()
+    {
+        Stop();
+    }
+
+    CaptureJournal(CaptureJournal const&) = delete;
+    CaptureJournal& operator=(CaptureJournal const&) = delete;
+
+    // A missing file reads as empty. Returns false only when the file is there
+    // but could not be read, in which case it must not be opened, as Open
+    // would cut it down to whatever was replayed.
+    static bool ReadFile(std::string const& fileName, std::string& outText)
+    {
+        outText.clear();
+        std::error_code errorCode;
+        bool isExisting = std::filesystem::exists(fileName, errorCode);
+        if (errorCode)
+            return false;
+        if (!isExisting)
+            return true;
+        std::FILE* inputFile = std::fopen(fileName.c_str(), "rb");
+        if (inputFile == nullptr)
+            return false;
+        char buffer[64 * 1024];
+        size_t readCount;
+        while ((readCount = std::fread(buffer, 1, sizeof(buffer), inputFile)) > 0)
+            outText.append(buffer, readCount);
+        bool isRead = !std::ferror(inputFile);
+        std::fclose(inputFile);
+        return isRead;
+    }
+
+    // Cuts the file back to validSize, dropping a record torn by a crash, and
+    // opens it for appending. A missing file is created with the header.
+    // validSize must come from replaying what ReadFile returned.
+    bool Open(std::string const& journalFileName, size_t validSize, std::string_view header, uint32_t flushMilliseconds)
+    {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        std::error_code errorCode;
+        bool isExisting = std::filesystem::exists(journalFileName, errorCode);
+        if (isExisting && std::filesystem::file_size(journalFileName, errorCode) != validSize)
+            std::filesystem::resize_file(journalFileName, validSize, errorCode);
+        if (errorCode)
+            return false;
+
+        file = std::fopen(journalFileName.c_str(), "ab");
+        if (file == nullptr)
+            return false;
+        if (!isExisting || validSize == 0)
+            WriteAndSync(header);
+
+        std::lock_guard<std::mutex> lock(recordMutex);
+        fileName = journalFileName;
+        flushInterval = std::chrono::milliseconds(flushMilliseconds == 0 ? 1 : flushMilliseconds);
+        isStopping = false;
+        return true;
+    }
+
+    bool IsOpen()
+    {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        return file != nullptr;
+    }
+
+    // Safe from any thread. Dropped if the journal is not open.
+    void Append(std::string record)
+    {
+        std::lock_guard<std::mutex> lock(recordMutex);
+        if (isStopping || fileName.empty())
+            return;
+        pendingRecords += record;
+        pendingCount++;
+        if (!flushThread.joinable())
+            flushThread = std::thread(&CaptureJournal::Run, this);
+    }
+
+    // Replaces the file with the given contents, for a checkpoint or a
+    // truncate. Records still queued are dropped, so the caller must pass
+    // contents that already include them. Written to a side file and synced
+    // before the rename, so a crash leaves either the old or the new journal.
+    bool Rewrite(std::string_view contents)
+    {
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        if (file == nullptr)
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(recordMutex);
+            pendingRecords.clear();
+            pendingCount = 0;
+        }
+
+        std::string sideFileName = fileName + ".new";
+        std::FILE* sideFile = std::fopen(sideFileName.c_str(), "wb");
+        if (sideFile == nullptr)
+            return false;
+        bool isWritten = std::fwrite(contents.data(), 1, contents.size(), sideFile) == contents.size() && SyncFile(sideFile);
+        std::fclose(sideFile);
+        std::error_code errorCode;
+        if (isWritten)
+            std::filesystem::rename(sideFileName, fileName, errorCode);
+        if (!isWritten || errorCode)
+        {
+            std::filesystem::remove(sideFileName, errorCode);
+            return false;
+        }
+
+        std::fclose(file);
+        file = std::fopen(fileName.c_str(), "ab");
+        std::lock_guard<std::mutex> lock(recordMutex);
+        isFailed = file == nullptr;
+        return file != nullptr;
+    }
+
+    CaptureJournalStats GetStats()
+    {
+        CaptureJournalStats stats;
+        std::lock_guard<std::mutex> lock(recordMutex);
+        stats.RecordsWritten = recordsWritten;
+        stats.Syncs = syncCount;
+        stats.PendingCount = pendingCount;
+        stats.IsFailed = isFailed;
+        return stats;
+    }
+
+    // Writes whatever is queued, then joins the thread and closes the file
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(recordMutex);
+            isStopping = true;
+            flushCondition.notify_one();
+        }
+        if (flushThread.joinable())
+            flushThread.join();
+        std::lock_guard<std::mutex> fileLock(fileMutex);
+        if (file != nullptr)
+        {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    static bool SyncFile(std::FILE* syncedFile)
+    {
+        if (std::fflush(syncedFile) != 0)
+            return false;
+#ifdef _WIN32
+        return _commit(_fileno(syncedFile)) == 0;
+#else
+        return fsync(fileno(syncedFile)) == 0;
+#endif
+    }
+
+    // fileMutex must be held
+    bool WriteAndSync(std::string_view text)
+    {
+        if (file == nullptr)
+            return false;
+        return std::fwrite(text.data(), 1, text.size(), file) == text.size() && SyncFile(file);
+    }
+
+    void Run()
+    {
+        std::string batch;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(recordMutex);
+                flushCondition.wait_for(lock, flushInterval, [this] { return isStopping; });
+            }
+
+            // The file lock is held from taking the batch to the sync, so a
+            // Rewrite can never land between the two and be appended to
+            std::lock_guard<std::mutex> fileLock(fileMutex);
+            size_t batchCount;
+            bool isLastBatch;
+            {
+                std::lock_guard<std::mutex> lock(recordMutex);
+                batch.swap(pendingRecords);
+                batchCount = pendingCount;
+                pendingCount = 0;
+                isLastBatch = isStopping;
+            }
+
+            if (batchCount > 0)
+            {
+                bool isWritten = WriteAndSync(batch);
+                std::lock_guard<std::mutex> lock(recordMutex);
+                isFailed |= !isWritten;
+                if (isWritten)
+                {
+                    recordsWritten += batchCount;
+                    syncCount++;
+                }
+            }
+            batch.clear();
+            if (isLastBatch)
+                return;
+        }
+    }
+
+    // Lock order is fileMutex, then recordMutex
+    std::mutex fileMutex;
+    std::FILE* file = nullptr;
+
+    std::mutex recordMutex;
+    std::condition_variable flushCondition;
+    std::string fileName;           // Written with both locks held, read under either
+    std::string pendingRecords;
+    size_t pendingCount = 0;
+    uint64_t recordsWritten = 0;
+    uint64_t syncCount = 0;
+    bool isFailed = false;
+    bool isStopping = false;
+    std::chrono::milliseconds flushInterval{ 1000 };
+    std::thread flushThread;
+};
+
+#endif
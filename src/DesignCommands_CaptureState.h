@@ -0,0 +1,380 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_CAPTURESTATE_H
+#define DESIGNCOMMANDS_CAPTURESTATE_H
+
+#include "DesignCommands_Format.h"
+#include "DesignCommands_LiquidScan.h"
+#include "DesignCommands_ZoneLines.h"
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum LiquidPlaneStep
+{
+    STEP_0_SOUTH_HEIGHT,
+    STEP_1_WEST,
+    STEP_2_EAST,
+    STEP_3_NORTH_HEIGHT
+};
+
+// Everything captured by hand during a session. The commands change it only
+// through the Apply functions below, and the journal replays the same calls,
+// so a replayed session ends up exactly where the live one was.
+class CaptureState
+{
+public:
+    std::list<LiquidPlane> LiquidPlanes;
+    LiquidPlane CurLiquidPlane;
+    LiquidPlaneStep CurLiquidPlaneStep = STEP_0_SOUTH_HEIGHT;
+    std::vector<ZoneLineCapture> ZoneLineCaptures;
+    uint32_t SelectedZoneLinePair = 0;
+
+    // First point of a .dgps pair, waiting for the second
+    std::string PendingDGPSText;
+};
+
+// Takes one walked liquid plane node and returns the step it was taken for.
+// The north node finishes the plane and also starts the next one.
+inline LiquidPlaneStep ApplyLiquidPlaneNode(CaptureState& state, float x, float y, float z)
+{
+    LiquidPlaneStep capturedStep = state.CurLiquidPlaneStep;
+    if (capturedStep == STEP_0_SOUTH_HEIGHT)
+    {
+        state.CurLiquidPlane.seCornerX = x - 0.01f;
+        state.CurLiquidPlane.bottomZ = z - 0.001f;
+        state.CurLiquidPlaneStep = STEP_1_WEST;
+    }
+    else if (capturedStep == STEP_1_WEST)
+    {
+        state.CurLiquidPlane.nwCornerY = y;
+        state.CurLiquidPlaneStep = STEP_2_EAST;
+    }
+    else if (capturedStep == STEP_2_EAST)
+    {
+        state.CurLiquidPlane.seCornerY = y;
+        state.CurLiquidPlaneStep = STEP_3_NORTH_HEIGHT;
+    }
+    else
+    {
+        state.CurLiquidPlane.nwCornerX = x;
+        state.CurLiquidPlane.topZ = z;
+        state.LiquidPlanes.push_back(state.CurLiquidPlane);
+        state.CurLiquidPlane.Reset();
+        state.CurLiquidPlane.seCornerX = x - 0.01f;
+        state.CurLiquidPlane.bottomZ = z - 0.001f;
+        state.CurLiquidPlaneStep = STEP_1_WEST;
+    }
+    return capturedStep;
+}
+
+inline void ClearLiquidPlanes(CaptureState& state)
+{
+    state.CurLiquidPlaneStep = STEP_0_SOUTH_HEIGHT;
+    state.CurLiquidPlane.Reset();
+    state.LiquidPlanes.clear();
+}
+
+// .dgps points come in pairs. The first is held, the second is joined to it,
+// and the pair is shown and dropped. Returns the text to show.
+inline std::string ApplyDGPSPoint(CaptureState& state, std::string_view pointText)
+{
+    bool isSecondPoint = !state.PendingDGPSText.empty();
+    if (isSecondPoint)
+        state.PendingDGPSText += '|';
+    state.PendingDGPSText += pointText;
+    if (!isSecondPoint)
+        return state.PendingDGPSText;
+    std::string shownText = std::move(state.PendingDGPSText);
+    state.PendingDGPSText.clear();
+    return shownText;
+}
+
+inline uint32_t FindZoneLinePair(std::vector<ZoneLinePairDefinition> const& pairs, std::string_view pairName)
+{
+    for (size_t pairIndex = 0; pairIndex < pairs.size(); ++pairIndex)
+        if (pairs[pairIndex].Name == pairName)
+            return uint32_t(pairIndex);
+    return uint32_t(pairs.size());
+}
+
+enum CaptureRecordType
+{
+    CAPTURE_LIQUID_NODE,        // lpnode x y z
+    CAPTURE_LIQUID_PLANE,       // lpplane nwX nwY topZ seX seY bottomZ slantType, a scanned or checkpointed plane
+    CAPTURE_LIQUID_CURRENT,     // lpcurrent step nwX nwY topZ seX seY bottomZ slantType, the plane being walked
+    CAPTURE_LIQUID_CLEAR,       // lpclear
+    CAPTURE_ZONE_LINE,          // zlcapture x y z pairName
+    CAPTURE_ZONE_LINE_PAIR,     // zlpair pairName
+    CAPTURE_ZONE_LINE_CLEAR,    // zlclear
+    CAPTURE_DGPS_POINT,         // dgps text
+    CAPTURE_RECORD_TYPE_COUNT
+};
+
+// One journal line: the tag, the values, then any text up to the end of the
+// line. Zone line pairs are written by name, since their indexes change when
+// the pair table changes.
+class CaptureRecord
+{
+public:
+    static constexpr size_t MaxValueCount = 7;
+
+    CaptureRecordType Type = CAPTURE_LIQUID_CLEAR;
+    float Values[MaxValueCount] = {};
+    std::string Text;
+};
+
+class CaptureRecordLayout
+{
+public:
+    char const* Tag;
+    size_t ValueCount;
+    bool HasText;
+};
+
+inline CaptureRecordLayout const& GetCaptureRecordLayout(CaptureRecordType type)
+{
+    static CaptureRecordLayout const layouts[CAPTURE_RECORD_TYPE_COUNT] =
+    {
+        { "lpnode",    3, false },
+        { "lpplane",   6, true },
+        { "lpcurrent", 7, true },
+        { "lpclear",   0, false },
+        { "zlcapture", 3, true },
+        { "zlpair",    0, true },
+        { "zlclear",   0, false },
+        { "dgps",      0, true }
+    };
+    return layouts[type];
+}
+
+// Appends the record as one line, newline included. Values are written in
+// their shortest exact form so a replay reproduces them bit for bit.
+inline void AppendCaptureRecord(std::string& output, CaptureRecord const& record)
+{
+    CaptureRecordLayout const& layout = GetCaptureRecordLayout(record.Type);
+    output += layout.Tag;
+    for (size_t valueIndex = 0; valueIndex < layout.ValueCount; ++valueIndex)
+    {
+        output += ' ';
+        AppendExactFloat(output, record.Values[valueIndex]);
+    }
+    if (layout.HasText)
+    {
+        output += ' ';
+        output += record.Text;
+    }
+    output += '\n';
+}
+
+inline std::string FormatCaptureRecord(CaptureRecord const& record)
+{
+    std::string output;
+    AppendCaptureRecord(output, record);
+    return output;
+}
+
+// Reads one line without its newline. Returns false for anything malformed.
+inline bool ParseCaptureRecord(std::string_view line, CaptureRecord& outRecord)
+{
+    size_t tagEnd = line.find(' ');
+    std::string_view tag = line.substr(0, tagEnd);
+    size_t typeIndex = 0;
+    while (typeIndex < CAPTURE_RECORD_TYPE_COUNT && tag != GetCaptureRecordLayout(CaptureRecordType(typeIndex)).Tag)
+        typeIndex++;
+    if (typeIndex == CAPTURE_RECORD_TYPE_COUNT)
+        return false;
+    outRecord.Type = CaptureRecordType(typeIndex);
+    CaptureRecordLayout const& layout = GetCaptureRecordLayout(outRecord.Type);
+
+    char const* cursor = line.data() + tag.size();
+    char const* end = line.data() + line.size();
+    for (size_t valueIndex = 0; valueIndex < layout.ValueCount; ++valueIndex)
+    {
+        if (cursor == end || *cursor != ' ')
+            return false;
+        std::from_chars_result result = std::from_chars(cursor + 1, end, outRecord.Values[valueIndex]);
+        if (result.ec != std::errc())
+            return false;
+        cursor = result.ptr;
+    }
+
+    outRecord.Text.clear();
+    if (!layout.HasText)
+        return cursor == end;
+    if (cursor == end || *cursor != ' ')
+        return false;
+    outRecord.Text.assign(cursor + 1, end);
+    return true;
+}
+
+// Replays one record. Zone line records naming a pair that is no longer
+// loaded return false and are left out.
+inline bool ApplyCaptureRecord(CaptureState& state, std::vector<ZoneLinePairDefinition> const& pairs, CaptureRecord const& record)
+{
+    float const* values = record.Values;
+    switch (record.Type)
+    {
+        case CAPTURE_LIQUID_NODE:
+            ApplyLiquidPlaneNode(state, values[0], values[1], values[2]);
+            return true;
+        case CAPTURE_LIQUID_PLANE:
+        case CAPTURE_LIQUID_CURRENT:
+        {
+            bool isCurrent = record.Type == CAPTURE_LIQUID_CURRENT;
+            if (isCurrent)
+            {
+                if (!(values[0] >= float(STEP_0_SOUTH_HEIGHT) && values[0] <= float(STEP_3_NORTH_HEIGHT)))
+                    return false;
+                state.CurLiquidPlaneStep = LiquidPlaneStep(int(values[0]));
+                values++;
+            }
+            LiquidPlane& plane = isCurrent ? state.CurLiquidPlane : state.LiquidPlanes.emplace_back();
+            plane.nwCornerX = values[0];
+            plane.nwCornerY = values[1];
+            plane.topZ = values[2];
+            plane.seCornerX = values[3];
+            plane.seCornerY = values[4];
+            plane.bottomZ = values[5];
+            plane.slantType = record.Text;
+            return true;
+        }
+        case CAPTURE_LIQUID_CLEAR:
+            ClearLiquidPlanes(state);
+            return true;
+        case CAPTURE_ZONE_LINE:
+        {
+            uint32_t pairIndex = FindZoneLinePair(pairs, record.Text);
+            if (pairIndex == pairs.size())
+                return false;
+            state.ZoneLineCaptures.push_back({ pairIndex, values[0], values[1], values[2], record.Text });
+            return true;
+        }
+        case CAPTURE_ZONE_LINE_PAIR:
+        {
+            uint32_t pairIndex = FindZoneLinePair(pairs, record.Text);
+            if (pairIndex == pairs.size())
+                return false;
+            state.SelectedZoneLinePair = pairIndex;
+            return true;
+        }
+        case CAPTURE_ZONE_LINE_CLEAR:
+            state.ZoneLineCaptures.clear();
+            return true;
+        case CAPTURE_DGPS_POINT:
+            ApplyDGPSPoint(state, record.Text);
+            return true;
+        default:
+            return false;
+    }
+}
+
+class CaptureReplayStats
+{
+public:
+    size_t AppliedCount = 0;
+    size_t SkippedCount = 0;
+
+    // Bytes up to the end of the last complete line. Anything after it is a
+    // record torn by a crash mid-write, and is cut off before appending.
+    size_t ValidSize = 0;
+};
+
+// Replays a whole journal into the state. Lines starting with '#' are comments.
+inline void ReplayCaptureJournal(std::string_view journalText, std::vector<ZoneLinePairDefinition> const& pairs, CaptureState& state, CaptureReplayStats& outStats)
+{
+    CaptureRecord record;
+    size_t lineStart = 0;
+    while (lineStart < journalText.size())
+    {
+        size_t lineEnd = journalText.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
+            break;
+        std::string_view line = journalText.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        outStats.ValidSize = lineStart;
+        if (line.empty() || line.front() == '#')
+            continue;
+        if (ParseCaptureRecord(line, record) && ApplyCaptureRecord(state, pairs, record))
+            outStats.AppliedCount++;
+        else
+            outStats.SkippedCount++;
+    }
+}
+
+constexpr char const* CaptureJournalHeader = "# mod-designcommands capture journal v1\n";
+
+// The shortest journal that replays to the current state
+inline std::string FormatCaptureCheckpoint(CaptureState const& state, std::vector<ZoneLinePairDefinition> const& pairs)
+{
+    std::string output = CaptureJournalHeader;
+    output.reserve(output.size() + (state.LiquidPlanes.size() + state.ZoneLineCaptures.size() + 4) * 128);
+    CaptureRecord record;
+    auto appendPlane = [&output, &record](LiquidPlane const& plane, size_t firstValue)
+    {
+        float planeValues[] = { plane.nwCornerX, plane.nwCornerY, plane.topZ, plane.seCornerX, plane.seCornerY, plane.bottomZ };
+        for (size_t valueIndex = 0; valueIndex < 6; ++valueIndex)
+            record.Values[firstValue + valueIndex] = planeValues[valueIndex];
+        record.Text = plane.slantType;
+        AppendCaptureRecord(output, record);
+    };
+
+    record.Type = CAPTURE_LIQUID_PLANE;
+    for (LiquidPlane const& plane : state.LiquidPlanes)
+        appendPlane(plane, 0);
+    if (state.CurLiquidPlaneStep != STEP_0_SOUTH_HEIGHT)
+    {
+        record.Type = CAPTURE_LIQUID_CURRENT;
+        record.Values[0] = float(state.CurLiquidPlaneStep);
+        appendPlane(state.CurLiquidPlane, 1);
+    }
+
+    if (state.SelectedZoneLinePair < pairs.size())
+    {
+        record.Type = CAPTURE_ZONE_LINE_PAIR;
+        record.Text = pairs[state.SelectedZoneLinePair].Name;
+        AppendCaptureRecord(output, record);
+    }
+    record.Type = CAPTURE_ZONE_LINE;
+    for (ZoneLineCapture const& capture : state.ZoneLineCaptures)
+    {
+        if (capture.PairIndex >= pairs.size())
+            continue;
+        record.Values[0] = capture.PositionX;
+        record.Values[1] = capture.PositionY;
+        record.Values[2] = capture.PositionZ;
+        record.Text = pairs[capture.PairIndex].Name;
+        AppendCaptureRecord(output, record);
+    }
+
+    if (!state.PendingDGPSText.empty())
+    {
+        record.Type = CAPTURE_DGPS_POINT;
+        record.Text = state.PendingDGPSText;
+        AppendCaptureRecord(output, record);
+    }
+    return output;
+}
+
+#endif
@@ -22,108 +22,678 @@
 #include "CommandScript.h"
 #include "Opcodes.h"
 #include "Player.h"
+#include "DetourNavMesh.h"
 #include "DetourNavMeshQuery.h"
+#include "MMapFactory.h"
 #include "MapMgr.h"
+#include "ObjectAccessor.h"
+#include "Config.h"
+
+#include "DesignCommands_BackgroundWriter.h"
+#include "DesignCommands_CaptureJournal.h"
+#include "DesignCommands_CaptureState.h"
+#include "DesignCommands_CreatureCommands.h"
+#include "DesignCommands_CreatureExport.h"
+#include "DesignCommands_CreatureRegistry.h"
+#include "DesignCommands_Format.h"
+#include "DesignCommands_LatencyHistogram.h"
+#include "DesignCommands_LiquidScan.h"
+#include "DesignCommands_NavAudit.h"
+#include "DesignCommands_OutputLog.h"
+#include "DesignCommands_PositionCommands.h"
+#include "DesignCommands_Terrain.h"
+#include "DesignCommands_WorkerPool.h"
+#include "DesignCommands_WorldScale.h"
+#include "DesignCommands_ZoneLines.h"
 
 #include <vector>
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "boost/algorithm/string.hpp"
-#include <regex>
 
 using namespace Acore::ChatCommands;
 using namespace std;
 
-static float WorldScale = 0.29f;
+static WorldScaleTable worldScales;
 
-class OutputFile
+static CreatureRegistryFeed<Creature> creatureRegistryFeed;
+static bool AllCreaturesFall = false;
+static bool isFallSnapMode = false;
+static BackgroundWriter exportWriter(8);
+static OutputLog designOutput;
+static WorkerPool workerPool;
+
+// <mapId>.heightfield is this header followed by Width * Height ground
+// heights and then Width * Height water levels, all raw little endian
+// floats. Rows step along Y and columns along X, starting at MinX/MinY in
+// WoW coordinates. Samples with no ground or water hold INVALID_HEIGHT or
+// VMAP_INVALID_HEIGHT_VALUE as returned by the map.
+struct HeightfieldHeader
+{
+    char Magic[4];
+    uint32 Version;
+    uint32 MapID;
+    uint32 Width;
+    uint32 Height;
+    float MinX;
+    float MinY;
+    float Step;
+    float WorldScale;
+};
+static_assert(sizeof(HeightfieldHeader) == 36, "HeightfieldHeader must stay packed");
+
+// World thread only
+static CreatureRegistry& GetCreatureRegistry()
+{
+    return creatureRegistryFeed.GetRegistry();
+}
+
+enum CreatureFallWorkType
+{
+    FALL_WORK_FALL,             // Toggle pass, fall in place
+    FALL_WORK_STEP_UP_AND_FALL, // New spawn, probe upward out of the ground first
+    FALL_WORK_SNAP              // Set straight to the resolved ground or water Z
+};
+
+class CreatureFallWorkItem
+{
+public:
+    ObjectGuid CreatureGUID;
+    CreatureFallWorkType WorkType;
+};
+
+class GroundHeightCacheStats
 {
 public:
-    void WriteLines(string fileName, vector<string> textRows)
+    uint64 Hits = 0;
+    uint64 Misses = 0;
+    size_t Entries = 0;
+    size_t Maps = 0;
+};
+
+class CreatureFallProgress
+{
+public:
+    size_t Pending = 0;
+    uint64 Processed = 0;
+    uint32 LastTickCount = 0;
+    uint64 LastTickMicroseconds = 0;
+    size_t HeightCacheEntries = 0;
+};
+
+// Spreads falls and height probes over map updates instead of doing a whole
+// map at once. Each map has its own queue, which is only drained from that
+// map's update so creatures are touched on the thread that owns them.
+class CreatureFallScheduler
+{
+public:
+    void Configure(uint32 creaturesPerTick, uint32 microsecondsPerTick)
+    {
+        maxCreaturesPerTick = creaturesPerTick;
+        maxMicrosecondsPerTick = microsecondsPerTick;
+    }
+
+    void Enqueue(Map* map, ObjectGuid creatureGUID, CreatureFallWorkType workType)
     {
-        ofstream outputFile(fileName.c_str());
-        for (string text : textRows)
+        MapQueue& mapQueue = GetOrCreateMapQueue(map);
+        std::lock_guard<std::mutex> lock(mapQueue.Lock);
+        mapQueue.Items.push_back({ creatureGUID, workType });
+        mapQueue.Progress.Pending = mapQueue.Items.size();
+        totalPending++;
+    }
+
+    void Update(Map* map)
+    {
+        if (totalPending.load(std::memory_order_relaxed) == 0)
+            return;
+
+        MapQueue* mapQueue = FindMapQueue(map);
+        if (mapQueue == nullptr)
+            return;
+
+        auto startTime = std::chrono::steady_clock::now();
+        uint32 processedCount = 0;
+        uint64 elapsedMicroseconds = 0;
+        while (maxCreaturesPerTick == 0 || processedCount < maxCreaturesPerTick)
         {
-            outputFile << text;
-            outputFile << "\n";
+            CreatureFallWorkItem workItem;
+            {
+                std::lock_guard<std::mutex> lock(mapQueue->Lock);
+                if (mapQueue->Items.empty())
+                    break;
+                workItem = mapQueue->Items.front();
+                mapQueue->Items.pop_front();
+                mapQueue->Progress.Pending = mapQueue->Items.size();
+            }
+            totalPending--;
+
+            // Creatures that left the world since being queued are skipped
+            if (Creature* creature = map->GetCreature(workItem.CreatureGUID))
+                ProcessCreature(map, *mapQueue, creature, workItem.WorkType);
+            processedCount++;
+
+            elapsedMicroseconds = uint64(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+            if (maxMicrosecondsPerTick != 0 && elapsedMicroseconds >= maxMicrosecondsPerTick)
+                break;
         }
-        outputFile.close();
+
+        if (processedCount == 0)
+            return;
+        heightCacheHits += mapQueue->HeightCacheHits;
+        heightCacheMisses += mapQueue->HeightCacheMisses;
+        mapQueue->HeightCacheHits = 0;
+        mapQueue->HeightCacheMisses = 0;
+
+        std::lock_guard<std::mutex> lock(mapQueue->Lock);
+        mapQueue->Progress.Processed += processedCount;
+        mapQueue->Progress.HeightCacheEntries = mapQueue->HeightCache.Size();
+        mapQueue->Progress.LastTickCount = processedCount;
+        mapQueue->Progress.LastTickMicroseconds = elapsedMicroseconds;
+    }
+
+    CreatureFallProgress GetProgress(Map* map)
+    {
+        MapQueue* mapQueue = FindMapQueue(map);
+        if (mapQueue == nullptr)
+            return CreatureFallProgress();
+        std::lock_guard<std::mutex> lock(mapQueue->Lock);
+        return mapQueue->Progress;
     }
+
+    GroundHeightCacheStats GetHeightCacheStats()
+    {
+        GroundHeightCacheStats stats;
+        stats.Hits = heightCacheHits;
+        stats.Misses = heightCacheMisses;
+        std::lock_guard<std::mutex> lock(mapQueuesLock);
+        for (auto const& mapQueue : mapQueues)
+        {
+            std::lock_guard<std::mutex> mapLock(mapQueue.second->Lock);
+            stats.Entries += mapQueue.second->Progress.HeightCacheEntries;
+        }
+        stats.Maps = mapQueues.size();
+        return stats;
+    }
+
+    // Snaps done outside the queue, such as .npcsnap, go in the same log
+    void AddSnapRecord(Map* map, GroundSnapRecord const& record)
+    {
+        MapQueue& mapQueue = GetOrCreateMapQueue(map);
+        std::lock_guard<std::mutex> lock(mapQueue.Lock);
+        mapQueue.SnapLog.Add(record);
+    }
+
+    vector<GroundSnapRecord> TakeSnapRecords(Map* map)
+    {
+        MapQueue* mapQueue = FindMapQueue(map);
+        if (mapQueue == nullptr)
+            return vector<GroundSnapRecord>();
+        std::lock_guard<std::mutex> lock(mapQueue->Lock);
+        return mapQueue->SnapLog.Take();
+    }
+
+    // Drops the queue, the height cache and unwritten snaps along with the map
+    void OnMapDestroyed(Map* map)
+    {
+        std::lock_guard<std::mutex> lock(mapQueuesLock);
+        auto mapQueueIter = mapQueues.find(map);
+        if (mapQueueIter == mapQueues.end())
+            return;
+        totalPending -= mapQueueIter->second->Items.size();
+        mapQueues.erase(mapQueueIter);
+    }
+
+private:
+    struct MapQueue
+    {
+        std::mutex Lock;
+        std::deque<CreatureFallWorkItem> Items;
+        CreatureFallProgress Progress;
+        GroundSnapLog SnapLog;
+
+        // Only touched from the map's own update
+        GroundHeightCache HeightCache;
+        uint64 HeightCacheHits = 0;
+        uint64 HeightCacheMisses = 0;
+    };
+
+    static void ProcessCreature(Map* map, MapQueue& mapQueue, Creature* creature, CreatureFallWorkType workType)
+    {
+        // Falls, step-ups and snaps only change Z, so the position is already final
+        creatureRegistryFeed.OnMoved(creature);
+
+        if (workType == FALL_WORK_FALL)
+        {
+            creature->GetMotionMaster()->MoveFall();
+            return;
+        }
+
+        if (workType == FALL_WORK_SNAP)
+        {
+            GroundSnapRecord snapRecord;
+            if (SnapCreature(map, creature, snapRecord))
+            {
+                std::lock_guard<std::mutex> lock(mapQueue.Lock);
+                mapQueue.SnapLog.Add(snapRecord);
+            }
+            return;
+        }
+
+        GroundHeightCache& heightCache = mapQueue.HeightCache;
+        float outHeight = heightCache.GetHeight(map, creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), mapQueue.HeightCacheHits, mapQueue.HeightCacheMisses);
+        if (designOutput.IsEchoingRows())
+            designOutput.Write(fmt::format("Creature: {}, Height: {}", creature->GetName() + "," + creature->GetCreatureTemplate()->SubName, outHeight));
+
+        StepUpOutOfGround(map, heightCache, creature, mapQueue.HeightCacheHits, mapQueue.HeightCacheMisses);
+
+        if (creature->isSwimming() == false)
+            creature->GetMotionMaster()->MoveFall();
+    }
+
+    MapQueue& GetOrCreateMapQueue(Map* map)
+    {
+        std::lock_guard<std::mutex> lock(mapQueuesLock);
+        std::unique_ptr<MapQueue>& mapQueue = mapQueues[map];
+        if (!mapQueue)
+            mapQueue = std::make_unique<MapQueue>();
+        return *mapQueue;
+    }
+
+    MapQueue* FindMapQueue(Map* map)
+    {
+        std::lock_guard<std::mutex> lock(mapQueuesLock);
+        auto mapQueueIter = mapQueues.find(map);
+        if (mapQueueIter == mapQueues.end())
+            return nullptr;
+        return mapQueueIter->second.get();
+    }
+
+    uint32 maxCreaturesPerTick = 100;
+    uint32 maxMicrosecondsPerTick = 2000;
+    std::atomic<size_t> totalPending{ 0 };
+    std::atomic<uint64> heightCacheHits{ 0 };
+    std::atomic<uint64> heightCacheMisses{ 0 };
+    std::mutex mapQueuesLock;
+    std::unordered_map<Map*, std::unique_ptr<MapQueue>> mapQueues;
 };
 
-string ConvertNumberToString(uint32 number)
-{
-    stringstream stringStreamOutput;
-    stringStreamOutput << number;
-    return stringStreamOutput.str();
-}
+static CreatureFallScheduler creatureFallScheduler;
 
-class CreatureReference
+// A teleport held back until the grids around its destination are loaded
+class PendingTeleport
 {
 public:
-    Creature* CreaturePtr;
-    uint32 MapID;
-    uint32 Entry;
-    string Name;
-    string SubName;    
+    uint64 RequestID = 0;
+    Map* DestinationMap = nullptr;
+    WorldLocation Destination;
+    vector<std::pair<float, float>> GridPoints;     // One point inside each grid still to load
+    size_t GridCount = 0;
+    size_t GridsLoaded = 0;
+    size_t GridsLoading = 0;
+    uint64 LoadMicroseconds = 0;
+    std::chrono::steady_clock::time_point RequestTime;
 };
 
-static std::list<CreatureReference> creatureReferences;
-static bool AllCreaturesFall = false;
+class FinishedTeleport
+{
+public:
+    ObjectGuid PlayerGUID;
+    WorldLocation Destination;
+    size_t GridCount = 0;
+    size_t GridsLoaded = 0;
+    uint64 LoadMicroseconds = 0;
+    uint64 WaitMicroseconds = 0;
+    bool IsTimedOut = false;
+};
 
-class DesignCommands_AllCreatureScripts : public AllCreatureScript
+// Loads the grids around a teleport destination, and with them the VMAP and
+// MMAP tiles, before the teleport is issued. Grids are loaded from the
+// destination map's own update a few per tick, so the loading happens on the
+// thread that owns the map and the hop itself lands on resident terrain.
+class TeleportPrefetcher
 {
 public:
-    DesignCommands_AllCreatureScripts()
-        : AllCreatureScript("DesignCommands_AllCreatureScripts")
+    void Configure(bool enabled, uint32 gridsPerTick, uint32 timeoutMilliseconds)
     {
+        isEnabled = enabled;
+        maxGridsPerTick = std::max<uint32>(1, gridsPerTick);
+        timeoutMicroseconds = uint64(timeoutMilliseconds) * 1000;
     }
 
-    void OnCreatureAddWorld(Creature* creature) override
+    // Returns how many grids have to load first, or 0 if the caller should
+    // teleport right away. A newer request for the same player replaces the old.
+    size_t Request(Player* player, WorldLocation const& destination)
     {
-        Map* curMap = creature->GetMap();
+        if (!isEnabled)
+            return 0;
+
+        // Instanced maps have no shared grids to warm up before entering
+        Map* map = sMapMgr->CreateBaseMap(destination.GetMapId());
+        if (map == nullptr || map->Instanceable())
+            return 0;
+
+        PendingTeleport pendingTeleport;
+        pendingTeleport.DestinationMap = map;
+        pendingTeleport.Destination = destination;
+        pendingTeleport.RequestTime = std::chrono::steady_clock::now();
+
+        // Everything within visibility range of the destination gets visited on arrival
+        float visibilityRange = map->GetVisibilityRange();
+        vector<uint64> seenGridKeys;
+        for (float offsetX : { -visibilityRange, 0.0f, visibilityRange })
+        {
+            for (float offsetY : { -visibilityRange, 0.0f, visibilityRange })
+            {
+                float pointX = destination.GetPositionX() + offsetX;
+                float pointY = destination.GetPositionY() + offsetY;
+                if (!Acore::IsValidMapCoord(pointX, pointY))
+                    continue;
+                GridCoord gridCoord = Acore::ComputeGridCoord(pointX, pointY);
+                uint64 gridKey = (uint64(gridCoord.x_coord) << 32) | gridCoord.y_coord;
+                if (std::find(seenGridKeys.begin(), seenGridKeys.end(), gridKey) != seenGridKeys.end())
+                    continue;
+                seenGridKeys.push_back(gridKey);
+                if (!map->IsGridLoaded(pointX, pointY))
+                    pendingTeleport.GridPoints.emplace_back(pointX, pointY);
+            }
+        }
+        size_t gridCount = pendingTeleport.GridPoints.size();
+        if (gridCount == 0)
+            return 0;
+        pendingTeleport.GridCount = gridCount;
+
+        std::lock_guard<std::mutex> lock(pendingLock);
+        pendingTeleport.RequestID = ++lastRequestID;
+        pendingTeleports[player->GetGUID()] = std::move(pendingTeleport);
+        pendingCount = pendingTeleports.size();
+        return gridCount;
+    }
 
-        CreatureReference creatureReference;
-        creatureReference.MapID = creature->GetMapId();
-        creatureReference.Entry = creature->GetEntry();
-        creatureReference.Name = creature->GetName();
-        creatureReference.SubName = creature->GetCreatureTemplate()->SubName;
-        creatureReference.CreaturePtr = creature;
-        creatureReferences.push_back(creatureReference);
+    // Called from each map update, loads grids for teleports headed to that map
+    void UpdateMap(Map* map)
+    {
+        if (pendingCount.load(std::memory_order_relaxed) == 0)
+            return;
 
-        if (AllCreaturesFall == true)
+        class GridLoad
         {
-            float outHeight = curMap->GetHeight(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), true, 150);
-            LOG_INFO("server.loading", "Creature: {}, Height: {}", creatureReference.Name + "," + creatureReference.SubName, outHeight);
-           
-            //if (creature->isSwimming() == false)
-            //    creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ() + 1, creature->GetOrientation());
-
-            bool isObjectInMap = false;
-            int maxStepUps = 10;
-            int curStep = 0;
-            while (isObjectInMap == false && curStep < maxStepUps)
+        public:
+            ObjectGuid PlayerGUID;
+            uint64 RequestID;
+            float PointX;
+            float PointY;
+        };
+        vector<GridLoad> gridLoads;
+        {
+            std::lock_guard<std::mutex> lock(pendingLock);
+            for (auto& pendingTeleport : pendingTeleports)
             {
-                float height = curMap->GetHeight(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), true, 150);
-                if (height < -10000)
+                PendingTeleport& pending = pendingTeleport.second;
+                while (pending.DestinationMap == map && !pending.GridPoints.empty() && gridLoads.size() < maxGridsPerTick)
                 {
-                    creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ() + 2.5 * curStep, creature->GetOrientation());
+                    gridLoads.push_back({ pendingTeleport.first, pending.RequestID, pending.GridPoints.back().first, pending.GridPoints.back().second });
+                    pending.GridPoints.pop_back();
+                    pending.GridsLoading++;
                 }
-                else
-                    isObjectInMap = true;
-                curStep++;
             }
+        }
 
-            if (creature->isSwimming() == false)
-                creature->GetMotionMaster()->MoveFall();
+        for (GridLoad const& gridLoad : gridLoads)
+        {
+            auto startTime = std::chrono::steady_clock::now();
+            map->LoadGrid(gridLoad.PointX, gridLoad.PointY);
+            uint64 loadMicroseconds = uint64(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+
+            // The teleport may have timed out or been replaced in the meantime
+            std::lock_guard<std::mutex> lock(pendingLock);
+            auto pendingIter = pendingTeleports.find(gridLoad.PlayerGUID);
+            if (pendingIter == pendingTeleports.end() || pendingIter->second.RequestID != gridLoad.RequestID)
+                continue;
+            pendingIter->second.GridsLoading--;
+            pendingIter->second.GridsLoaded++;
+            pendingIter->second.LoadMicroseconds += loadMicroseconds;
+        }
+    }
+
+    // Called from the world update, hands back teleports that are ready to go
+    void CollectFinished(vector<FinishedTeleport>& outFinished)
+    {
+        if (pendingCount.load(std::memory_order_relaxed) == 0)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(pendingLock);
+        for (auto pendingIter = pendingTeleports.begin(); pendingIter != pendingTeleports.end();)
+        {
+            PendingTeleport const& pending = pendingIter->second;
+            uint64 waitMicroseconds = uint64(std::chrono::duration_cast<std::chrono::microseconds>(now - pending.RequestTime).count());
+            bool isLoaded = pending.GridsLoaded == pending.GridCount;
+            bool isTimedOut = !isLoaded && waitMicroseconds >= timeoutMicroseconds;
+            if (!isLoaded && !isTimedOut)
+            {
+                ++pendingIter;
+                continue;
+            }
+
+            outFinished.push_back({ pendingIter->first, pending.Destination, pending.GridCount, pending.GridsLoaded, pending.LoadMicroseconds, waitMicroseconds, isTimedOut });
+            pendingIter = pendingTeleports.erase(pendingIter);
+        }
+        pendingCount = pendingTeleports.size();
+    }
+
+    void OnMapDestroyed(Map* map)
+    {
+        std::lock_guard<std::mutex> lock(pendingLock);
+        for (auto pendingIter = pendingTeleports.begin(); pendingIter != pendingTeleports.end();)
+        {
+            if (pendingIter->second.DestinationMap == map)
+                pendingIter = pendingTeleports.erase(pendingIter);
+            else
+                ++pendingIter;
+        }
+        pendingCount = pendingTeleports.size();
+    }
+
+private:
+    bool isEnabled = true;
+    uint32 maxGridsPerTick = 1;
+    uint64 timeoutMicroseconds = 5000000;
+    uint64 lastRequestID = 0;
+    std::atomic<size_t> pendingCount{ 0 };
+    std::mutex pendingLock;
+    std::unordered_map<ObjectGuid, PendingTeleport> pendingTeleports;
+};
+
+static TeleportPrefetcher teleportPrefetcher;
+
+// Teleports the player once the destination grids are resident, or right away
+// if there is nothing to load
+static void TeleportWithPrefetch(Player* player, WorldLocation const& destination)
+{
+    size_t gridCount = teleportPrefetcher.Request(player, destination);
+    if (gridCount == 0)
+    {
+        player->TeleportTo(destination);
+        return;
+    }
+    ChatHandler(player->GetSession()).PSendSysMessage("Loading {} grids around the destination before teleporting", gridCount);
+}
+
+// A sampling command waiting on its map. Finish runs on the export writer
+// with the filled grid and returns the message for the GM.
+class TerrainSampleJob
+{
+public:
+    uint64 RequesterGUID = 0;
+    TerrainGridSampler Sampler;
+    std::function<string(LiquidScanGrid&)> Finish;
+};
+
+// Samples terrain for .heightfieldwrite and .lpscan from the update of the map being
+// sampled, a slice per tick, so the lookups and the terrain loads they cause
+// happen on the thread that owns the map. Only the finished grid goes to the
+// export writer. Jobs on a map run one after another.
+class TerrainSampleScheduler
+{
+public:
+    static constexpr size_t MaxJobs = 8;
+
+    void Configure(uint32 gridsPerTick, uint32 microsecondsPerTick)
+    {
+        maxGridsPerTick = gridsPerTick;
+        maxMicrosecondsPerTick = microsecondsPerTick;
+    }
+
+    // Returns false if too many jobs are already waiting
+    bool Enqueue(Map* map, std::shared_ptr<TerrainSampleJob> job)
+    {
+        std::lock_guard<std::mutex> lock(jobsLock);
+        if (jobCount >= MaxJobs)
+            return false;
+        mapJobs[map].push_back(std::move(job));
+        jobCount++;
+        return true;
+    }
+
+    void Update(Map* map)
+    {
+        if (jobCount.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::shared_ptr<TerrainSampleJob> job;
+        {
+            std::lock_guard<std::mutex> lock(jobsLock);
+            auto mapJobsIter = mapJobs.find(map);
+            if (mapJobsIter == mapJobs.end())
+                return;
+            job = mapJobsIter->second.front();
+        }
+
+        if (!job->Sampler.IsDone() && !job->Sampler.Step(map, workerPool, maxGridsPerTick, maxMicrosecondsPerTick))
+            return;
+
+        // A full export queue keeps the grid here until a later tick
+        if (!exportWriter.TryEnqueue(job->RequesterGUID, [job]() { return job->Finish(job->Sampler.GetGrid()); }))
+            return;
+
+        std::lock_guard<std::mutex> lock(jobsLock);
+        auto mapJobsIter = mapJobs.find(map);
+        mapJobsIter->second.pop_front();
+        if (mapJobsIter->second.empty())
+            mapJobs.erase(mapJobsIter);
+        jobCount--;
+    }
+
+    void OnMapDestroyed(Map* map)
+    {
+        std::lock_guard<std::mutex> lock(jobsLock);
+        auto mapJobsIter = mapJobs.find(map);
+        if (mapJobsIter == mapJobs.end())
+            return;
+        designOutput.Write(fmt::format("Dropped {} terrain samplings, their map {} was unloaded", mapJobsIter->second.size(), map->GetId()));
+        jobCount -= mapJobsIter->second.size();
+        mapJobs.erase(mapJobsIter);
+    }
 
-            
+private:
+    uint32 maxGridsPerTick = 4;
+    uint32 maxMicrosecondsPerTick = 5000;
+    std::atomic<size_t> jobCount{ 0 };
+    std::mutex jobsLock;
+    std::unordered_map<Map*, std::deque<std::shared_ptr<TerrainSampleJob>>> mapJobs;
+};
+
+static TerrainSampleScheduler terrainSampleScheduler;
+
+// One dtNavMeshQuery per audit worker, kept between audits. A query is set up
+// again when it was last used on a different navmesh.
+class NavMeshQueryPool
+{
+public:
+    ~NavMeshQueryPool()
+    {
+        for (QuerySlot& slot : slots)
+            dtFreeNavMeshQuery(slot.Query);
+    }
+
+    // Called before the workers start, each worker then only touches its own slot
+    void Reserve(size_t workerCount)
+    {
+        if (slots.size() < workerCount)
+            slots.resize(workerCount);
+    }
+
+    dtNavMeshQuery* Get(size_t workerIndex, dtNavMesh const* navMesh)
+    {
+        QuerySlot& slot = slots[workerIndex];
+        if (slot.Query == nullptr)
+            slot.Query = dtAllocNavMeshQuery();
+        if (slot.Query == nullptr)
+            return nullptr;
+        if (slot.NavMesh != navMesh)
+        {
+            if (dtStatusFailed(slot.Query->init(navMesh, MaxSearchNodes)))
+            {
+                slot.NavMesh = nullptr;
+                return nullptr;
+            }
+            slot.NavMesh = navMesh;
         }
+        return slot.Query;
+    }
+
+private:
+    // Nearest poly lookups do not search, so a small node pool is enough
+    static constexpr int MaxSearchNodes = 256;
+
+    struct QuerySlot
+    {
+        dtNavMeshQuery* Query = nullptr;
+        dtNavMesh const* NavMesh = nullptr;
+    };
+
+    vector<QuerySlot> slots;
+};
+
+static NavMeshQueryPool navMeshQueryPool;
+
+class DesignCommands_AllCreatureScripts : public AllCreatureScript
+{
+public:
+    DesignCommands_AllCreatureScripts()
+        : AllCreatureScript("DesignCommands_AllCreatureScripts")
+    {
+    }
+
+    void OnCreatureAddWorld(Creature* creature) override
+    {
+        creatureRegistryFeed.OnAdd(creature);
+
+        // The step-up probe and fall (or the snap) are done later, a few creatures per map update
+        if (AllCreaturesFall == true)
+            creatureFallScheduler.Enqueue(creature->GetMap(), creature->GetGUID(), isFallSnapMode ? FALL_WORK_SNAP : FALL_WORK_STEP_UP_AND_FALL);
+    }
+
+    void OnCreatureRemoveWorld(Creature* creature) override
+    {
+        creatureRegistryFeed.OnRemove(creature);
     }
 };
 
+// Survey lists loaded with .eqxyz, by player GUID
+static std::unordered_map<uint64, EQSurveyList> eqSurveyLists;
+
 class DesignCommandsPlayerScript : public PlayerScript
 {
 public:
@@ -133,276 +703,922 @@ public:
     {
 
     }
+
+    void OnPlayerLogout(Player* player) override
+    {
+        eqSurveyLists.erase(player->GetGUID().GetRawValue());
+    }
 };
 
-static std::string RoundVal(float value, int places)
+class DesignCommandsAllMapScript : public AllMapScript
 {
-    // Scale, round, and scale back
-    float scale = 100000.0f; // 10^6 for 6 decimal places
-    float roundedValue;
-    if (value < std::numeric_limits<float>::epsilon() && value > -std::numeric_limits<float>::epsilon())
-        roundedValue = 0;
-    else
-        roundedValue = std::round((value + std::numeric_limits<float>::epsilon()) * scale) / scale;
-
-    std::ostringstream stream;
-    stream << std::fixed << std::setprecision(6) << roundedValue;
-    return stream.str();
+public:
+    DesignCommandsAllMapScript() : AllMapScript("DesignCommandsAllMapScript") {}
+
+    void OnMapUpdate(Map* map, uint32 /*diff*/) override
+    {
+        creatureFallScheduler.Update(map);
+        teleportPrefetcher.UpdateMap(map);
+        terrainSampleScheduler.Update(map);
+    }
+
+    void OnDestroyMap(Map* map) override
+    {
+        creatureFallScheduler.OnMapDestroyed(map);
+        teleportPrefetcher.OnMapDestroyed(map);
+        terrainSampleScheduler.OnMapDestroyed(map);
+    }
+};
+
+// Zone line pairs come from DesignCommands.ZoneLines.PairFile, or the built-in
+// table when that is empty. Captures are kept raw until .zlwrite.
+static vector<ZoneLinePairDefinition> zoneLinePairs;
+
+// Liquid plane, zone line and .dgps captures, rebuilt from the journal at startup
+static CaptureState captureState;
+static CaptureJournal captureJournal;
+
+static void OpenCaptureJournal()
+{
+    string journalFileName = sConfigMgr->GetOption<std::string>("DesignCommands.Journal.File", "designcommands.journal");
+    if (journalFileName.empty())
+        return;
+
+    auto startTime = std::chrono::steady_clock::now();
+    string journalText;
+    CaptureReplayStats replayStats;
+    if (!CaptureJournal::ReadFile(journalFileName, journalText))
+    {
+        LOG_ERROR("server.loading", "DesignCommands: could not read capture journal {}, leaving it untouched and not journaling captures", journalFileName);
+        return;
+    }
+    ReplayCaptureJournal(journalText, zoneLinePairs, captureState, replayStats);
+    if (!captureJournal.Open(journalFileName, replayStats.ValidSize, CaptureJournalHeader, sConfigMgr->GetOption<uint32>("DesignCommands.Journal.FlushMilliseconds", 1000)))
+    {
+        LOG_ERROR("server.loading", "DesignCommands: could not open capture journal {}, captures will not survive a restart", journalFileName);
+        return;
+    }
+
+    auto elapsedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+    if (replayStats.AppliedCount > 0 || replayStats.SkippedCount > 0 || replayStats.ValidSize < journalText.size())
+        LOG_INFO("server.loading", "DesignCommands: replayed {} captures from {} in {} ms ({} skipped, {} torn bytes cut): {} liquid planes, {} zone lines",
+            replayStats.AppliedCount, journalFileName, elapsedMilliseconds, replayStats.SkippedCount, journalText.size() - replayStats.ValidSize,
+            captureState.LiquidPlanes.size(), captureState.ZoneLineCaptures.size());
+}
+
+static void LoadWorldScales()
+{
+    float defaultScale = sConfigMgr->GetOption<float>("DesignCommands.WorldScale", DefaultWorldScale);
+    string mapScaleText = sConfigMgr->GetOption<std::string>("DesignCommands.WorldScale.Maps", "");
+    if (!worldScales.Load(defaultScale, mapScaleText))
+        LOG_ERROR("server.loading", "DesignCommands: WorldScale settings are malformed, keeping a default scale of {} and the previous map scales", worldScales.GetDefaultScale());
+}
+
+static void LoadZoneLinePairs()
+{
+    std::string pairTableText = DefaultZoneLinePairTable;
+    std::string pairFileName = sConfigMgr->GetOption<std::string>("DesignCommands.ZoneLines.PairFile", "");
+    if (!pairFileName.empty())
+    {
+        std::ifstream pairFile(pairFileName);
+        if (pairFile)
+            pairTableText.assign(std::istreambuf_iterator<char>(pairFile), std::istreambuf_iterator<char>());
+        else
+            LOG_ERROR("server.loading", "DesignCommands: could not open zone line pair file {}, using the built-in pairs", pairFileName);
+    }
+
+    vector<ZoneLinePairDefinition> loadedPairs;
+    if (size_t badLine = ParseZoneLinePairTable(pairTableText, loadedPairs))
+    {
+        LOG_ERROR("server.loading", "DesignCommands: zone line pair table line {} is malformed, keeping the previous pairs", badLine);
+        return;
+    }
+
+    // Captures and the selection follow their pair by name into the new table.
+    // Nothing is journaled, replay resolves the names against the table in
+    // use at the time in the same way.
+    string selectedPairName = captureState.SelectedZoneLinePair < zoneLinePairs.size() ? zoneLinePairs[captureState.SelectedZoneLinePair].Name : string();
+    zoneLinePairs = std::move(loadedPairs);
+    if (size_t droppedCount = RemapZoneLineCaptures(zoneLinePairs, captureState.ZoneLineCaptures))
+        LOG_INFO("server.loading", "DesignCommands: dropping {} zone line captures whose pair is no longer in the pair table", droppedCount);
+    captureState.ZoneLineCaptures.reserve(1024);
+    uint32 selectedPair = FindZoneLinePair(zoneLinePairs, selectedPairName);
+    captureState.SelectedZoneLinePair = selectedPair < zoneLinePairs.size() ? selectedPair : 0;
+}
+
+class DesignCommandsWorldScript : public WorldScript
+{
+public:
+    DesignCommandsWorldScript() : WorldScript("DesignCommandsWorldScript") {}
+
+    void OnAfterConfigLoad(bool /*reload*/) override
+    {
+        uint32 configuredWorkerThreads = sConfigMgr->GetOption<uint32>("DesignCommands.WorkerThreads", 0);
+        workerPool.Configure(configuredWorkerThreads == 0 ? GetDefaultWorkerCount() : configuredWorkerThreads);
+        creatureFallScheduler.Configure(sConfigMgr->GetOption<uint32>("DesignCommands.Fall.CreaturesPerTick", 100),
+            sConfigMgr->GetOption<uint32>("DesignCommands.Fall.MicrosecondsPerTick", 2000));
+        isFallSnapMode = sConfigMgr->GetOption<bool>("DesignCommands.Fall.Snap", false);
+        teleportPrefetcher.Configure(sConfigMgr->GetOption<bool>("DesignCommands.Prefetch.Enable", true),
+            sConfigMgr->GetOption<uint32>("DesignCommands.Prefetch.GridsPerTick", 1),
+            sConfigMgr->GetOption<uint32>("DesignCommands.Prefetch.TimeoutMilliseconds", 5000));
+        terrainSampleScheduler.Configure(sConfigMgr->GetOption<uint32>("DesignCommands.Terrain.GridsPerTick", 4),
+            sConfigMgr->GetOption<uint32>("DesignCommands.Terrain.MicrosecondsPerTick", 5000));
+        LoadWorldScales();
+        designOutput.Configure(sConfigMgr->GetOption<uint32>("DesignCommands.Output.BufferLines", OutputLog::DefaultCapacity),
+            sConfigMgr->GetOption<uint32>("DesignCommands.Output.FlushMilliseconds", 200),
+            sConfigMgr->GetOption<bool>("DesignCommands.Output.EchoRows", true),
+            [](string const& block) { LOG_INFO("server.loading", "{}", block); });
+        LoadZoneLinePairs();
+        if (!captureJournal.IsOpen())
+            OpenCaptureJournal();
+    }
+
+    void OnUpdate(uint32 /*diff*/) override
+    {
+        // Keeps the queue short even when no command reads the registry
+        creatureRegistryFeed.Apply();
+
+        // Tell GMs about finished exports, from the world thread
+        vector<BackgroundWriter::Completion> completions;
+        exportWriter.PollCompletions(completions);
+        for (BackgroundWriter::Completion const& completion : completions)
+        {
+            designOutput.Write(completion.Message);
+            if (Player* player = ObjectAccessor::FindConnectedPlayer(ObjectGuid(completion.RequesterGUID)))
+                ChatHandler(player->GetSession()).PSendSysMessage(completion.Message);
+        }
+
+        // Issue teleports whose destination grids are now loaded. The load
+        // time is what the hop would otherwise have stalled for on arrival.
+        vector<FinishedTeleport> finishedTeleports;
+        teleportPrefetcher.CollectFinished(finishedTeleports);
+        for (FinishedTeleport const& finishedTeleport : finishedTeleports)
+        {
+            Player* player = ObjectAccessor::FindConnectedPlayer(finishedTeleport.PlayerGUID);
+            if (player == nullptr)
+                continue;
+            player->TeleportTo(finishedTeleport.Destination);
+            ChatHandler(player->GetSession()).PSendSysMessage("Prefetched {} of {} grids{}, {} ms of loading moved ahead of the hop ({} ms wait)",
+                finishedTeleport.GridsLoaded, finishedTeleport.GridCount, finishedTeleport.IsTimedOut ? " before timing out" : "",
+                finishedTeleport.LoadMicroseconds / 1000, finishedTeleport.WaitMicroseconds / 1000);
+        }
+    }
+
+    void OnShutdown() override
+    {
+        exportWriter.Stop();
+        workerPool.Stop();
+        captureJournal.Stop();
+        designOutput.Stop();
+    }
+};
+
+// Planes found by .lpscan on the export thread, picked up by .lpwrite. They
+// are journaled once picked up, until then a rescan gets them back.
+static std::mutex scannedLiquidPlanesLock;
+static vector<LiquidPlane> scannedLiquidPlanes;
+
+// Wraps a command handler so that every call is timed into its own histogram
+template <auto Handler>
+class TimedCommand;
+
+template <typename... Args, bool (*Handler)(ChatHandler*, Args...)>
+class TimedCommand<Handler>
+{
+public:
+    inline static LatencyHistogram Histogram;
+
+    static bool Invoke(ChatHandler* handler, Args... args)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        bool result = Handler(handler, std::move(args)...);
+        Histogram.Record(uint64(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count()));
+        return result;
+    }
+};
+
+// Commands only run on the world thread, so the histograms need no locking
+static vector<std::pair<string, LatencyHistogram*>> commandLatencyHistograms;
+
+// Returns the function itself, as the command table binds handlers by reference
+template <auto Handler>
+static auto& Timed(char const* commandName)
+{
+    commandLatencyHistograms.emplace_back(commandName, &TimedCommand<Handler>::Histogram);
+    return TimedCommand<Handler>::Invoke;
 }
 
-class LiquidPlane
+class DesignCommands_CommandScript : public CommandScript
 {
 public:
-    float nwCornerX;
-    float nwCornerY;
-    float topZ;
-    float seCornerX;
-    float seCornerY;
-    float bottomZ;
+    DesignCommands_CommandScript() : CommandScript("DesignCommands_CommandScript") { }
+
+    ChatCommandTable GetCommands() const
+    {
+        static ChatCommandTable designCommandTable =
+        {
+            { "dgps",                  Timed<HandleDGPSCommand>("dgps"),                              SEC_MODERATOR,          Console::No  },
+            { "sgps",                  Timed<HandleSGPSCommand>("sgps"),                              SEC_MODERATOR,          Console::No  },
+            { "eqxyz",                 Timed<HandleEQXYZCommand>("eqxyz"),                            SEC_MODERATOR,          Console::No  },
+            { "eqxyznext",             Timed<HandleEQXYZNextCommand>("eqxyznext"),                    SEC_MODERATOR,          Console::No  },
+            { "eqxyzprev",             Timed<HandleEQXYZPrevCommand>("eqxyzprev"),                    SEC_MODERATOR,          Console::No  },
+            { "zlcapture",             Timed<HandleZoneLineCaptureCommand>("zlcapture"),              SEC_MODERATOR,          Console::No  },
+            { "zlpair",                Timed<HandleZoneLinePairCommand>("zlpair"),                    SEC_MODERATOR,          Console::No  },
+            { "zlwrite",               Timed<HandleZoneLineWriteCommand>("zlwrite"),                  SEC_MODERATOR,          Console::No  },
+            { "zlstephigh",            Timed<HandleZoneLineStepHighCommand>("zlstephigh"),            SEC_MODERATOR,          Console::No  },
+            { "zlsteplow",             Timed<HandleZoneLineStepLowCommand>("zlsteplow"),              SEC_MODERATOR,          Console::No  },
+            { "zlclear",               Timed<HandleZoneLineClearCommand>("zlclear"),                  SEC_MODERATOR,          Console::No  },
+            { "lpcapture",             Timed<HandleLiquidPlaneNodeCaptureCommand>("lpcapture"),       SEC_MODERATOR,          Console::No  },
+            { "lpscan",                Timed<HandleLiquidPlaneScanCommand>("lpscan"),                 SEC_MODERATOR,          Console::No  },
+            { "lpwrite",               Timed<HandleLiquidPlaneWriteCommand>("lpwrite"),               SEC_MODERATOR,          Console::No  },
+            { "lpclear",               Timed<HandleLiquidPlaneClearCommand>("lpclear"),               SEC_MODERATOR,          Console::No  },
+            { "journalcheckpoint",     Timed<HandleJournalCheckpointCommand>("journalcheckpoint"),    SEC_MODERATOR,          Console::No  },
+            { "journaltruncate",       Timed<HandleJournalTruncateCommand>("journaltruncate"),        SEC_MODERATOR,          Console::No  },
+            { "zonecreatureswrite",    Timed<HandleWriteZoneCreatures>("zonecreatureswrite"),         SEC_MODERATOR,          Console::No  },
+            { "zonecreaturescompact",  Timed<HandleCompactZoneCreatures>("zonecreaturescompact"),     SEC_MODERATOR,          Console::No  },
+            { "zonecreaturescount",    Timed<HandleCountZoneCreatures>("zonecreaturescount"),         SEC_MODERATOR,          Console::No  },
+            { "zonecreaturesnear",     Timed<HandleNearZoneCreatures>("zonecreaturesnear"),           SEC_MODERATOR,          Console::No  },
+            { "zonecreaturesbox",      Timed<HandleBoxZoneCreatures>("zonecreaturesbox"),             SEC_MODERATOR,          Console::No  },
+            { "heightfieldwrite",      Timed<HandleHeightfieldWrite>("heightfieldwrite"),             SEC_MODERATOR,          Console::No  },
+            { "navaudit",              Timed<HandleNavAuditCommand>("navaudit"),                      SEC_MODERATOR,          Console::No  },
+            { "allcreaturefall",       Timed<HandleAllCreatureFall>("allcreaturefall"),               SEC_MODERATOR,          Console::No  },
+            { "allcreaturefallstatus", Timed<HandleAllCreatureFallStatus>("allcreaturefallstatus"),   SEC_MODERATOR,          Console::No  },
+            { "allcreaturesnap",       Timed<HandleAllCreatureSnap>("allcreaturesnap"),               SEC_MODERATOR,          Console::No  },
+            { "snapwrite",             Timed<HandleSnapWrite>("snapwrite"),                           SEC_MODERATOR,          Console::No  },
+            { "heightcachestats",      Timed<HandleHeightCacheStats>("heightcachestats"),             SEC_MODERATOR,          Console::No  },
+            { "npcdown",               Timed<HandleNPCDown>("npcdown"),                               SEC_MODERATOR,          Console::No  },
+            { "npcup",                 Timed<HandleNPCUp>("npcup"),                                   SEC_MODERATOR,          Console::No  },
+            { "npcsnap",               Timed<HandleNPCSnap>("npcsnap"),                               SEC_MODERATOR,          Console::No  },
+            { "dcstats",               Timed<HandleDesignCommandStats>("dcstats"),                    SEC_MODERATOR,          Console::No  },
+        };
+
+        return designCommandTable;
+    }
+
+    // The chat side of the command bodies in the DesignCommands_*Commands.h headers
+    static auto ReplyTo(ChatHandler* handler)
+    {
+        return [handler](std::string const& text) { handler->SendSysMessage(text); };
+    }
+
+    static auto TeleportFor(ChatHandler* handler)
+    {
+        return [handler](uint32 mapID, float x, float y, float z, float orientation) { return DoTeleport(handler, { x, y, z, orientation }, mapID); };
+    }
+
+    // For steps that skip the checks and recall point of DoTeleport
+    static auto PrefetchTeleportFor(Player* player)
+    {
+        return [player](uint32 mapID, float x, float y, float z, float orientation)
+        {
+            TeleportWithPrefetch(player, { mapID, { x, y, z, orientation } });
+            return true;
+        };
+    }
+
+    // Copy and paste from the AzerothCore go XYZ method, mostly
+    static auto GoToEQCoordinatesFor(ChatHandler* handler)
+    {
+        return [handler](vector<float> const& locationValues)
+        {
+            Player* player = handler->GetSession()->GetPlayer();
+            return TeleportToEQCoordinates(locationValues, player->GetMapId(), player->GetOrientation(), worldScales,
+                [handler](uint32 mapID, float x, float y)
+                {
+                    if (sMapStore.LookupEntry(mapID) && MapMgr::IsValidMapCoord(mapID, x, y))
+                        return true;
+                    handler->SendErrorMessage(LANG_INVALID_TARGET_COORD, x, y, mapID);
+                    return false;
+                },
+                [](uint32 mapID, float x, float y)
+                {
+                    Map const* map = sMapMgr->CreateBaseMap(mapID);
+                    return std::max(map->GetHeight(x, y, MAX_HEIGHT), map->GetWaterLevel(x, y));
+                },
+                TeleportFor(handler));
+        };
+    }
+
+    static bool HandleDesignCommandStats(ChatHandler* handler, Optional<std::string_view> action)
+    {
+        bool doReset = action && *action == "reset";
+        handler->PSendSysMessage("Command: calls, p50 / p95 / p99 / max in microseconds");
+        for (auto const& commandLatencyHistogram : commandLatencyHistograms)
+        {
+            LatencyHistogram& histogram = *commandLatencyHistogram.second;
+            if (histogram.Count() == 0)
+                continue;
+            string text = fmt::format("{}: {}, {} / {} / {} / {}", commandLatencyHistogram.first, histogram.Count(), histogram.Percentile(0.50),
+                histogram.Percentile(0.95), histogram.Percentile(0.99), histogram.Max());
+            handler->PSendSysMessage(text);
+            designOutput.Write(text);
+        }
+
+        if (doReset)
+        {
+            for (auto const& commandLatencyHistogram : commandLatencyHistograms)
+                commandLatencyHistogram.second->Reset();
+            handler->PSendSysMessage("Command timings reset");
+        }
+        return true;
+    }
+
+    // .eqxyz x y [z [mapId [o]]], or several of those separated by ';' or
+    // line breaks to load them as a survey list stepped with .eqxyznext/.eqxyzprev
+    static bool HandleEQXYZCommand(ChatHandler* handler, Tail args)
+    {
+        return RunEQXYZ(args, eqSurveyLists, handler->GetSession()->GetPlayer()->GetGUID().GetRawValue(), ReplyTo(handler), GoToEQCoordinatesFor(handler));
+    }
+
+    static bool HandleEQXYZNextCommand(ChatHandler* handler)
+    {
+        return StepEQSurvey(eqSurveyLists, handler->GetSession()->GetPlayer()->GetGUID().GetRawValue(), 1, ReplyTo(handler), GoToEQCoordinatesFor(handler));
+    }
 
-    LiquidPlane() : nwCornerX(0), nwCornerY(0), topZ(0), seCornerX(0), seCornerY(0), bottomZ(0) {}
+    static bool HandleEQXYZPrevCommand(ChatHandler* handler)
+    {
+        return StepEQSurvey(eqSurveyLists, handler->GetSession()->GetPlayer()->GetGUID().GetRawValue(), -1, ReplyTo(handler), GoToEQCoordinatesFor(handler));
+    }
+
+    static bool DoTeleport(ChatHandler* handler, Position pos, uint32 mapId = MAPID_INVALID)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+
+        if (mapId == MAPID_INVALID)
+            mapId = player->GetMapId();
+        if (!MapMgr::IsValidMapCoord(mapId, pos) || sObjectMgr->IsTransportMap(mapId))
+        {
+            handler->SendErrorMessage(LANG_INVALID_TARGET_COORD, pos.GetPositionX(), pos.GetPositionY(), mapId);
+            return false;
+        }
+
+        // stop flight if need
+        if (player->IsInFlight())
+        {
+            player->GetMotionMaster()->MovementExpired();
+            player->CleanupAfterTaxiFlight();
+        }
+        // save only in non-flight case
+        else
+            player->SaveRecallPosition();
+
+        TeleportWithPrefetch(player, { mapId, pos });
+        return true;
+    }
+
+    static void DropSelectedCreature(ChatHandler* handler, float zOffset)
+    {
+        Creature* creature = handler->getSelectedCreature();
+        if (creature == nullptr)
+            return;
+        Map* map = creature->GetMap();
+        DropCreature(creatureRegistryFeed, map, creature, zOffset, isFallSnapMode, [map](GroundSnapRecord const& snapRecord)
+        {
+            creatureFallScheduler.AddSnapRecord(map, snapRecord);
+        });
+    }
+
+    static bool HandleNPCUp(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    {
+        DropSelectedCreature(handler, 3);
+        return true;
+    }
+
+    static bool HandleNPCDown(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    {
+        DropSelectedCreature(handler, -3);
+        return true;
+    }
+
+    static bool HandleNPCSnap(ChatHandler* handler)
+    {
+        Creature* creature = handler->getSelectedCreature();
+        Map* map = creature != nullptr ? creature->GetMap() : nullptr;
+        return SnapSelectedCreature(creatureRegistryFeed, map, creature, [map](GroundSnapRecord const& snapRecord)
+        {
+            creatureFallScheduler.AddSnapRecord(map, snapRecord);
+        }, ReplyTo(handler));
+    }
+
+    static bool HandleAllCreatureSnap(ChatHandler* handler)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+        size_t queuedCount = 0;
+        GetCreatureRegistry().ForEachCreatureInMap(player->GetMapId(), [&queuedCount](Creature* creature)
+        {
+            creatureFallScheduler.Enqueue(creature->GetMap(), creature->GetGUID(), FALL_WORK_SNAP);
+            queuedCount++;
+        });
+        handler->PSendSysMessage("Queued {} creatures to snap, use .allcreaturefallstatus to follow progress and .snapwrite to write the deltas", queuedCount);
+        return true;
+    }
+
+    static bool HandleSnapWrite(ChatHandler* handler)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+        uint32 mapID = player->GetMapId();
+        vector<GroundSnapRecord> snapRecords = creatureFallScheduler.TakeSnapRecords(player->GetMap());
+        if (snapRecords.empty())
+        {
+            handler->PSendSysMessage("No creatures have been snapped on this map since the last write");
+            return true;
+        }
+
+        float worldScale = worldScales.GetScale(mapID);
+        bool isQueued = exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), [mapID, worldScale, snapRecords]()
+        {
+            string fileName = ConvertNumberToString(mapID) + ".snaps.txt";
+            ofstream outputFile(fileName.c_str());
+            outputFile << FormatGroundSnapReport(mapID, worldScale, snapRecords);
+            outputFile.close();
+            return fmt::format("Wrote {} ground snaps to {}", snapRecords.size(), fileName);
+        });
+        if (!isQueued)
+        {
+            // Copied into the job rather than moved, so they can go back for the next try
+            for (GroundSnapRecord const& snapRecord : snapRecords)
+                creatureFallScheduler.AddSnapRecord(player->GetMap(), snapRecord);
+            handler->PSendSysMessage("Export queue is full, try again once the current exports finish");
+            return false;
+        }
+        return true;
+    }
+
+    static bool HandleAllCreatureFall(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+        size_t queuedCount = 0;
+        if (AllCreaturesFall == false)
+            GetCreatureRegistry().ForEachCreatureInMap(player->GetMapId(), [&queuedCount](Creature* creature)
+            {
+                creatureFallScheduler.Enqueue(creature->GetMap(), creature->GetGUID(), isFallSnapMode ? FALL_WORK_SNAP : FALL_WORK_FALL);
+                queuedCount++;
+            });
+        AllCreaturesFall = !AllCreaturesFall;
+        designOutput.Write(fmt::format("= All Creature Fall Toggle {} ===========================================", AllCreaturesFall));
+        if (queuedCount > 0)
+            handler->PSendSysMessage("Queued {} creatures to {}, use .allcreaturefallstatus to follow progress", queuedCount, isFallSnapMode ? "snap" : "fall");
+        return true;
+    }
 
-    void Reset()
+    static bool HandleHeightCacheStats(ChatHandler* handler)
     {
-        nwCornerX = 0;
-        nwCornerY = 0;
-        topZ = 0;
-        seCornerX = 0;
-        seCornerY = 0;
-        bottomZ = 0;
+        GroundHeightCacheStats stats = creatureFallScheduler.GetHeightCacheStats();
+        uint64 lookups = stats.Hits + stats.Misses;
+        handler->PSendSysMessage("Height cache: {} hits, {} misses ({}% hit rate), {} entries across {} maps",
+            stats.Hits, stats.Misses, lookups == 0 ? 0 : stats.Hits * 100 / lookups, stats.Entries, stats.Maps);
+        return true;
+    }
+
+    static bool HandleAllCreatureFallStatus(ChatHandler* handler)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+        CreatureFallProgress progress = creatureFallScheduler.GetProgress(player->GetMap());
+        handler->PSendSysMessage("All creature fall is {} ({} mode). Pending: {}, processed: {}, last tick: {} creatures in {} us",
+            AllCreaturesFall ? "on" : "off", isFallSnapMode ? "snap" : "fall", progress.Pending, progress.Processed, progress.LastTickCount, progress.LastTickMicroseconds);
+        return true;
+    }
+
+    static bool HandleCountZoneCreatures(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
+        uint32 mapID = player->GetMapId();
+
+        designOutput.Write("= Counting Creatures ===================================");
+        size_t count = GetCreatureRegistry().CountInMap(mapID);
+        designOutput.Write(fmt::format("Zone Creature Count: {}", count));
+        designOutput.Write(fmt::format("Registry: {} live creatures in {} slots", GetCreatureRegistry().Count(), GetCreatureRegistry().SlotCapacity()));
+
+        return true;
+    }
+
+    static bool HandleNearZoneCreatures(ChatHandler* handler, float radius)
+    {
+        // Covers a whole map from any point on it
+        float const maxRadius = SIZE_OF_GRIDS * MAX_NUMBER_OF_GRIDS;
+
+        Player* player = handler->GetSession()->GetPlayer();
+        size_t count = 0;
+        if (!ListCreaturesNear(creatureRegistryFeed, designOutput, player->GetMapId(), player->GetPositionX(), player->GetPositionY(), maxRadius, radius, count))
+        {
+            handler->PSendSysMessage("Radius must be a number of yards, 0 or more");
+            return false;
+        }
+        handler->PSendSysMessage("{} creatures within {} yards", count, radius);
+
+        return true;
     }
 
-    void ToString()
+    static bool HandleBoxZoneCreatures(ChatHandler* handler, float minX, float minY, float maxX, float maxY)
     {
-        LOG_INFO("server.loading", "zoneProperties.AddLiquidPlane(LiquidType.Water, \"t50_sbw1\", {}f, {}f, {}f, {}f, {}f, {}f, LiquidSlantType.NorthHighSouthLow, 250f);",
-            RoundVal(nwCornerX, 6),
-            RoundVal(nwCornerY, 6),
-            RoundVal(seCornerX, 6),
-            RoundVal(seCornerY, 6),
-            RoundVal(topZ, 6),
-            RoundVal(bottomZ, 6));
+        Player* player = handler->GetSession()->GetPlayer();
+        size_t count = 0;
+        if (!ListCreaturesInBox(creatureRegistryFeed, designOutput, player->GetMapId(), minX, minY, maxX, maxY, count))
+        {
+            handler->PSendSysMessage("Box corners must be numbers");
+            return false;
+        }
+        handler->PSendSysMessage("{} creatures in box", count);
+
+        return true;
     }
-};
 
-enum LiquidPlaneStep
-{
-    STEP_0_SOUTH_HEIGHT,
-    STEP_1_WEST,
-    STEP_2_EAST,
-    STEP_3_NORTH_HEIGHT
-};
+    static bool HandleHeightfieldWrite(ChatHandler* handler, float minX, float minY, float maxX, float maxY, float step)
+    {
+        // Keeps a single raster under 128MB of samples
+        uint64 const maxSampleCount = 16 * 1024 * 1024;
 
-static std::string otherZoneLineCoordinates;
-static std::string thisZoneLineCoordinates;
-static std::list<LiquidPlane> liquidPlanes;
-static LiquidPlaneStep curLiquidPlaneStep = LiquidPlaneStep::STEP_0_SOUTH_HEIGHT;
-static LiquidPlane curLiquidPlane;
+        Player* player = handler->GetSession()->GetPlayer();
+        uint32 mapID = player->GetMapId();
 
-class DesignCommands_CommandScript : public CommandScript
-{
-public:
-    DesignCommands_CommandScript() : CommandScript("DesignCommands_CommandScript") { }
+        if (step <= 0)
+        {
+            handler->PSendSysMessage("Step must be greater than zero");
+            return false;
+        }
+        if (minX > maxX)
+            std::swap(minX, maxX);
+        if (minY > maxY)
+            std::swap(minY, maxY);
+
+        uint32 width = uint32((maxX - minX) / step) + 1;
+        uint32 height = uint32((maxY - minY) / step) + 1;
+        if (uint64(width) * uint64(height) > maxSampleCount)
+        {
+            handler->PSendSysMessage("{} x {} samples is too many, use a larger step or a smaller area", width, height);
+            return false;
+        }
 
-    ChatCommandTable GetCommands() const
-    {
-        static ChatCommandTable designCommandTable =
+        HeightfieldHeader header;
+        std::copy_n("DCHF", 4, header.Magic);
+        header.Version = 1;
+        header.MapID = mapID;
+        header.Width = width;
+        header.Height = height;
+        header.MinX = minX;
+        header.MinY = minY;
+        header.Step = step;
+        header.WorldScale = worldScales.GetScale(mapID);
+
+        LiquidScanGrid grid;
+        grid.Width = width;
+        grid.Height = height;
+        grid.MinX = minX;
+        grid.MinY = minY;
+        grid.Step = step;
+
+        std::shared_ptr<TerrainSampleJob> job = std::make_shared<TerrainSampleJob>();
+        job->RequesterGUID = player->GetGUID().GetRawValue();
+        job->Sampler.Start(std::move(grid), MAX_HEIGHT, SIZE_OF_GRIDS);
+        auto startTime = std::chrono::steady_clock::now();
+        job->Finish = [header, startTime](LiquidScanGrid& sampledGrid)
         {
-            { "dgps",                   HandleDGPSCommand,                   SEC_MODERATOR,          Console::No  },
-            { "sgps",                   HandleSGPSCommand,                   SEC_MODERATOR,          Console::No  },
-            { "eqxyz",                  HandleEQXYZCommand,                  SEC_MODERATOR,          Console::No  },
-            { "zlcapture",              HandleZoneLineCaptureCommand,        SEC_MODERATOR,          Console::No  },
-            { "zlwrite",                HandleZoneLineWriteCommand,          SEC_MODERATOR,          Console::No  },
-            { "zlstephigh",             HandleZoneLineStepHighCommand,       SEC_MODERATOR,          Console::No  },
-            { "zlsteplow",              HandleZoneLineStepLowCommand,        SEC_MODERATOR,          Console::No  },
-            { "zlclear",                HandleZoneLineClearCommand,          SEC_MODERATOR,          Console::No  },
-            { "lpcapture",              HandleLiquidPlaneNodeCaptureCommand, SEC_MODERATOR,          Console::No  },
-            { "lpwrite",                HandleLiquidPlaneWriteCommand,       SEC_MODERATOR,          Console::No  },
-            { "lpclear",                HandleLiquidPlaneClearCommand,       SEC_MODERATOR,          Console::No  },
-            { "zonecreatureswrite",     HandleWriteZoneCreatures,            SEC_MODERATOR,          Console::No  },
-            { "zonecreaturescount",     HandleCountZoneCreatures,            SEC_MODERATOR,          Console::No  },
-            { "allcreaturefall",        HandleAllCreatureFall,               SEC_MODERATOR,          Console::No  },
-            { "npcdown",                HandleNPCDown,                       SEC_MODERATOR,          Console::No  },
-            { "npcup",                  HandleNPCUp,                         SEC_MODERATOR,          Console::No  },
+            size_t sampleCount = sampledGrid.GroundHeights.size();
+            string fileName = ConvertNumberToString(header.MapID) + ".heightfield";
+            ofstream outputFile(fileName.c_str(), std::ios::binary);
+            outputFile.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            outputFile.write(reinterpret_cast<char const*>(sampledGrid.GroundHeights.data()), std::streamsize(sampleCount * sizeof(float)));
+            outputFile.write(reinterpret_cast<char const*>(sampledGrid.WaterLevels.data()), std::streamsize(sampleCount * sizeof(float)));
+            outputFile.close();
+
+            auto elapsedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+            return fmt::format("Wrote {} x {} heightfield to {} in {} ms", header.Width, header.Height, fileName, elapsedMilliseconds);
         };
 
-        return designCommandTable;
-    }
-
-    // Copy and paste from the AzerothCore go XYZ method, mostly
-    static bool HandleEQXYZCommand(ChatHandler* handler, Tail args)
-    {
-        std::wstring wInputCoords;
-        if (!Utf8toWStr(args, wInputCoords))
+        if (!terrainSampleScheduler.Enqueue(player->GetMap(), std::move(job)))
         {
+            handler->PSendSysMessage("Too many terrain samplings are waiting, try again once the current ones finish");
             return false;
         }
+        handler->PSendSysMessage("Sampling {} x {} heightfield over the next map updates on {} threads", width, height, workerPool.GetWorkerCount());
 
-        // extract float and integer values from the input
-        std::vector<float> locationValues;
-        std::wregex floatRegex(L"(-?\\d+(?:\\.\\d+)?)");
-        std::wsregex_iterator floatRegexIterator(wInputCoords.begin(), wInputCoords.end(), floatRegex);
-        std::wsregex_iterator end;
-        while (floatRegexIterator != end)
-        {
-            std::wsmatch match = *floatRegexIterator;
-            std::wstring matchStr = match.str();
+        return true;
+    }
 
-            // try to convert the match to a float
-            try
+    // Every poly that can be walked to from startRef, following the links
+    // between polys (off-mesh connections included) that pass the filter
+    static void CollectReachablePolys(dtNavMesh const* navMesh, dtQueryFilter const& filter, dtPolyRef startRef, std::unordered_set<dtPolyRef>& outPolyRefs)
+    {
+        vector<dtPolyRef> pendingPolyRefs;
+        pendingPolyRefs.push_back(startRef);
+        outPolyRefs.insert(startRef);
+        while (!pendingPolyRefs.empty())
+        {
+            dtPolyRef polyRef = pendingPolyRefs.back();
+            pendingPolyRefs.pop_back();
+            dtMeshTile const* tile = nullptr;
+            dtPoly const* poly = nullptr;
+            navMesh->getTileAndPolyByRefUnsafe(polyRef, &tile, &poly);
+            for (unsigned int linkIndex = poly->firstLink; linkIndex != DT_NULL_LINK; linkIndex = tile->links[linkIndex].next)
             {
-                locationValues.push_back(std::stof(matchStr));
+                dtPolyRef neighbourRef = tile->links[linkIndex].ref;
+                if (neighbourRef == 0 || outPolyRefs.count(neighbourRef) != 0)
+                    continue;
+                dtMeshTile const* neighbourTile = nullptr;
+                dtPoly const* neighbourPoly = nullptr;
+                navMesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
+                if (!filter.passFilter(neighbourRef, neighbourTile, neighbourPoly))
+                    continue;
+                outPolyRefs.insert(neighbourRef);
+                pendingPolyRefs.push_back(neighbourRef);
             }
-            // if the match is not a float, do not add it to the vector
-            catch (std::invalid_argument const&) {}
-
-            ++floatRegexIterator;
         }
+    }
 
-        // X and Y are required
-        if (locationValues.size() < 2)
+    // Looks up the nearest poly of every spawn, split across the workers. This
+    // runs from the command, so on the world thread while no map is updating
+    // and no tile can be added or removed under the queries. Returns whether
+    // reachability was checked, which needs the requester to stand on the mesh.
+    static bool AuditNavMeshSpawns(dtNavMesh const* navMesh, Position const& requesterPosition, vector<NavAuditSpawn> const& spawns, vector<NavAuditResult>& results)
+    {
+        // Recast axes are (y, z, x) in world terms
+        float const searchExtents[3] = { 20.0f, 40.0f, 20.0f };
+        float const requesterExtents[3] = { 3.0f, 5.0f, 3.0f };
+        dtQueryFilter filter;
+        navMeshQueryPool.Reserve(workerPool.GetWorkerCount());
+
+        std::unordered_set<dtPolyRef> reachablePolyRefs;
+        dtNavMeshQuery* requesterQuery = navMeshQueryPool.Get(0, navMesh);
+        float requesterPoint[3] = { requesterPosition.GetPositionY(), requesterPosition.GetPositionZ(), requesterPosition.GetPositionX() };
+        float nearestPoint[3];
+        dtPolyRef requesterPolyRef = 0;
+        if (requesterQuery != nullptr && dtStatusSucceed(requesterQuery->findNearestPoly(requesterPoint, requesterExtents, &filter, &requesterPolyRef, nearestPoint)) && requesterPolyRef != 0)
+            CollectReachablePolys(navMesh, filter, requesterPolyRef, reachablePolyRefs);
+        bool isReachabilityChecked = !reachablePolyRefs.empty();
+
+        workerPool.ParallelFor(spawns.size(), 256, [&](size_t beginSpawn, size_t endSpawn, size_t workerIndex)
         {
-            return false;
-        }
+            dtNavMeshQuery* query = navMeshQueryPool.Get(workerIndex, navMesh);
+            if (query == nullptr)
+                return;
+            for (size_t spawnIndex = beginSpawn; spawnIndex < endSpawn; ++spawnIndex)
+            {
+                NavAuditSpawn const& spawn = spawns[spawnIndex];
+                NavAuditResult& result = results[spawnIndex];
+                float spawnPoint[3] = { spawn.PositionY, spawn.PositionZ, spawn.PositionX };
+                float polyPoint[3];
+                dtPolyRef polyRef = 0;
+                if (dtStatusFailed(query->findNearestPoly(spawnPoint, searchExtents, &filter, &polyRef, polyPoint)) || polyRef == 0)
+                    continue;
+                result.HasPoly = true;
+                float deltaX = polyPoint[2] - spawnPoint[2];
+                float deltaY = polyPoint[0] - spawnPoint[0];
+                float deltaZ = polyPoint[1] - spawnPoint[1];
+                result.Distance = std::sqrt(deltaX * deltaX + deltaY * deltaY + deltaZ * deltaZ);
+                result.IsReachable = !isReachabilityChecked || reachablePolyRefs.count(polyRef) != 0;
+            }
+        });
+        return isReachabilityChecked;
+    }
 
+    // .navaudit [maxOffset]
+    // Checks every registered creature on the current map against the navmesh
+    // and writes the ones with no poly in range, more than maxOffset yards
+    // (default 2) off the mesh, or cut off from where the GM stands to
+    // <mapId>.navaudit.txt, worst first.
+    static bool HandleNavAuditCommand(ChatHandler* handler, Optional<float> maxOffset)
+    {
         Player* player = handler->GetSession()->GetPlayer();
+        uint32 mapID = player->GetMapId();
+        dtNavMesh const* navMesh = MMAP::MMapFactory::createOrGetMMapMgr()->GetNavMesh(mapID);
+        return AuditCreatureNavMesh(creatureRegistryFeed, mapID, maxOffset, navMesh != nullptr, workerPool.GetWorkerCount(),
+            [navMesh, player](vector<NavAuditSpawn> const& spawns, vector<NavAuditResult>& results)
+            {
+                return AuditNavMeshSpawns(navMesh, *player, spawns, results);
+            },
+            [player](std::function<string()> writeJob)
+            {
+                return exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), std::move(writeJob));
+            },
+            ReplyTo(handler));
+    }
 
-        uint32 mapId = locationValues.size() >= 4 ? uint32(locationValues[3]) : player->GetMapId();
+    static void AddCreatureExportRows(uint32 mapID, vector<CreatureExportRow>& exportRows)
+    {
+        exportRows.reserve(exportRows.size() + GetCreatureRegistry().CountInMap(mapID));
+        GetCreatureRegistry().ForEachInMap(mapID, [&exportRows](Creature* creature, CreatureReference const& creatureReference)
+        {
+            exportRows.push_back(MakeCreatureExportRow(creature, creatureReference.Entry));
+        });
+    }
 
-        float x = locationValues[0];
-        float y = locationValues[1];
+    // .zonecreatureswrite [all] [text|binary|both] or .zonecreatureswrite delta
+    // Writes the current map, or every map with creatures when "all" is given, as text unless told otherwise.
+    // A binary export is the base that "delta" tracks changes against and .zonecreaturescompact folds into.
+    static bool HandleWriteZoneCreatures(ChatHandler* handler, Tail args)
+    {
+        Player* player = handler->GetSession()->GetPlayer();
 
-        if (!sMapStore.LookupEntry(mapId) || !MapMgr::IsValidMapCoord(mapId, x, y))
+        bool writeAllMaps = false;
+        bool writeDelta = false;
+        bool writeText = true;
+        bool writeBinary = false;
+        string argumentText(args);
+        vector<string> arguments;
+        boost::split(arguments, argumentText, boost::is_any_of(" "), boost::token_compress_on);
+        for (string const& argument : arguments)
         {
-            handler->SendErrorMessage(LANG_INVALID_TARGET_COORD, x, y, mapId);
-            return false;
+            if (argument.empty())
+                continue;
+            if (argument == "all")
+                writeAllMaps = true;
+            else if (argument == "delta")
+                writeDelta = true;
+            else if (argument == "binary")
+            {
+                writeText = false;
+                writeBinary = true;
+            }
+            else if (argument == "both")
+            {
+                writeText = true;
+                writeBinary = true;
+            }
+            else if (argument == "text")
+            {
+                writeText = true;
+                writeBinary = false;
+            }
+            else
+            {
+                handler->PSendSysMessage("Unknown option {}, expected all, delta, text, binary or both", argument);
+                return false;
+            }
         }
 
-        Map const* map = sMapMgr->CreateBaseMap(mapId);
-
-        float z = locationValues.size() >= 3 ? locationValues[2] : std::max(map->GetHeight(x, y, MAX_HEIGHT), map->GetWaterLevel(x, y));
-        // map ID (locationValues[3]) already handled above
-        float o = locationValues.size() >= 5 ? locationValues[4] : player->GetOrientation();
-
-        // Scale the values
-        x *= WorldScale;
-        y *= WorldScale;
-        z *= WorldScale;
-
-        if (!MapMgr::IsValidMapCoord(mapId, x, y, z, o))
+        if (writeDelta)
         {
-            handler->SendErrorMessage(LANG_INVALID_TARGET_COORD, x, y, mapId);
-            return false;
+            if (writeAllMaps)
+            {
+                handler->PSendSysMessage("Delta exports are per map, run it on the map you changed");
+                return false;
+            }
+            return QueueZoneCreaturesDeltaWrite(handler, player->GetMapId());
         }
 
-        return DoTeleport(handler, { x, y, z, o }, mapId);
+        if (writeAllMaps == false)
+            return QueueZoneCreaturesWrite(handler, player->GetMapId(), writeText, writeBinary);
+        return QueueAllZoneCreaturesWrite(handler, writeText, writeBinary);
     }
-    static bool DoTeleport(ChatHandler* handler, Position pos, uint32 mapId = MAPID_INVALID)
+
+    static bool QueueZoneCreaturesWrite(ChatHandler* handler, uint32 mapID, bool writeText, bool writeBinary)
     {
         Player* player = handler->GetSession()->GetPlayer();
 
-        if (mapId == MAPID_INVALID)
-            mapId = player->GetMapId();
-        if (!MapMgr::IsValidMapCoord(mapId, pos) || sObjectMgr->IsTransportMap(mapId))
+        // Only copy what the rows need here, formatting and file I/O happen on the writer thread
+        vector<CreatureExportRow> exportRows;
+        AddCreatureExportRows(mapID, exportRows);
+
+        size_t rowCount = exportRows.size();
+        float worldScale = worldScales.GetScale(mapID);
+        bool isQueued = exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), [mapID, worldScale, writeText, writeBinary, exportRows = std::move(exportRows)]() mutable
         {
-            handler->SendErrorMessage(LANG_INVALID_TARGET_COORD, pos.GetPositionX(), pos.GetPositionY(), mapId);
-            return false;
-        }
+            designOutput.Write("= Writing Creature Data ===========================================");
+            UnscaleCreatureExportRows(exportRows, worldScale);
+            size_t byteCount = 0;
+            if (writeText)
+                byteCount += WriteCreatureTextExport(mapID, exportRows, designOutput);
+            if (writeBinary)
+            {
+                byteCount += WriteCreatureBinaryExport(mapID, worldScale, exportRows);
+                std::remove(GetCreatureDeltaFileName(mapID).c_str());
+            }
+            return fmt::format("Done writing {} creatures for map {} ({} bytes)", exportRows.size(), mapID, byteCount);
+        });
 
-        // stop flight if need
-        if (player->IsInFlight())
+        if (!isQueued)
         {
-            player->GetMotionMaster()->MovementExpired();
-            player->CleanupAfterTaxiFlight();
+            handler->PSendSysMessage("Export queue is full, try again once the current exports finish");
+            return false;
         }
-        // save only in non-flight case
-        else
-            player->SaveRecallPosition();
+        handler->PSendSysMessage("Queued {} creatures for export", rowCount);
+
+        // A new binary base starts change tracking over
+        if (writeBinary)
+            GetCreatureRegistry().ClearChangesInMap(mapID);
 
-        player->TeleportTo({ mapId, pos });
         return true;
     }
 
-    static bool HandleNPCUp(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    static bool QueueZoneCreaturesDeltaWrite(ChatHandler* handler, uint32 mapID)
     {
-        Creature* creature = handler->getSelectedCreature();
-        if (creature != nullptr)
+        Player* player = handler->GetSession()->GetPlayer();
+
+        size_t changedCount = 0;
+        size_t removedCount = 0;
+        float worldScale = worldScales.GetScale(mapID);
+        CreatureDeltaQueueResult queueResult = QueueCreatureDelta(creatureRegistryFeed, mapID,
+            [player, mapID, worldScale](vector<CreatureExportRow>&& changedRows, vector<uint32>&& removedSpawnIDs)
         {
-            creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ() + 3, creature->GetOrientation());
-            creature->GetMotionMaster()->MoveFall();
-        }
-        return true;
-    }
+            return exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), [mapID, worldScale, changedRows = std::move(changedRows), removedSpawnIDs = std::move(removedSpawnIDs)]() mutable
+            {
+                UnscaleCreatureExportRows(changedRows, worldScale);
+                size_t byteCount = AppendCreatureDeltaExport(mapID, removedSpawnIDs, changedRows);
+                return fmt::format("Appended {} changed and {} removed creatures to {} ({} bytes)", changedRows.size(), removedSpawnIDs.size(), GetCreatureDeltaFileName(mapID), byteCount);
+            });
+        }, changedCount, removedCount);
 
-    static bool HandleNPCDown(ChatHandler* handler, Optional<PlayerIdentifier> target)
-    {
-        Creature* creature = handler->getSelectedCreature();
-        if (creature != nullptr)
+        if (queueResult == CREATURE_DELTA_NO_CHANGES)
         {
-            creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ() - 3, creature->GetOrientation());
-            creature->GetMotionMaster()->MoveFall();
+            handler->PSendSysMessage("No creature changes on map {} since the last export", mapID);
+            return true;
+        }
+        if (queueResult == CREATURE_DELTA_QUEUE_FULL)
+        {
+            handler->PSendSysMessage("Export queue is full, try again once the current exports finish");
+            return false;
         }
+        handler->PSendSysMessage("Queued {} changed and {} removed creatures for the delta export", changedCount, removedCount);
         return true;
     }
 
-    static std::string RoundVals(float valueX, float valueY, float valueZ, int places)
-    {
-        std::ostringstream stream;
-        stream << RoundVal(valueX, 6) << "f, " << RoundVal(valueY, 6) << "f, " << RoundVal(valueZ, 6) << "f";
-        return stream.str();
-    }
-
-    static bool HandleAllCreatureFall(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    static bool HandleCompactZoneCreatures(ChatHandler* handler)
     {
         Player* player = handler->GetSession()->GetPlayer();
-        if (AllCreaturesFall == false)
-            for (auto& creatureReference : creatureReferences)
-                if (creatureReference.CreaturePtr != nullptr)
-                    if (player->GetMapId() == creatureReference.MapID)
-                        creatureReference.CreaturePtr->GetMotionMaster()->MoveFall();
-        AllCreaturesFall = !AllCreaturesFall;
-        LOG_INFO("server.loading", "= All Creature Fall Toggle {} ===========================================", AllCreaturesFall);
+        uint32 mapID = player->GetMapId();
+        bool isQueued = exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), [mapID]()
+        {
+            return CompactCreatureExport(mapID, designOutput);
+        });
+        if (!isQueued)
+        {
+            handler->PSendSysMessage("Export queue is full, try again once the current exports finish");
+            return false;
+        }
+        handler->PSendSysMessage("Queued compaction of the creature export for map {}", mapID);
         return true;
     }
 
-    static bool HandleCountZoneCreatures(ChatHandler* handler, Optional<PlayerIdentifier> target)
+    static bool QueueAllZoneCreaturesWrite(ChatHandler* handler, bool writeText, bool writeBinary)
     {
+        struct MapCreatureExport
+        {
+            uint32 MapID;
+            float WorldScale;
+            vector<CreatureExportRow> ExportRows;
+            size_t ByteCount;
+        };
+
         Player* player = handler->GetSession()->GetPlayer();
-        uint32 mapID = player->GetMapId();
 
-        int count = 0;
-        LOG_INFO("server.loading", "= Counting Creatures ===================================");
-        for (auto& creatureReference : creatureReferences)
+        // Snapshot every map here while no map is updating, the writer thread fans out from there
+        vector<MapCreatureExport> mapExports;
+        size_t rowCount = 0;
+        for (uint32 mapID : GetCreatureRegistry().GetMapIDs())
         {
-            if (player->GetMapId() == creatureReference.MapID)
-                count++;
+            MapCreatureExport mapExport;
+            mapExport.MapID = mapID;
+            mapExport.WorldScale = worldScales.GetScale(mapID);
+            mapExport.ByteCount = 0;
+            AddCreatureExportRows(mapID, mapExport.ExportRows);
+            rowCount += mapExport.ExportRows.size();
+            mapExports.push_back(std::move(mapExport));
         }
-        LOG_INFO("server.loading", "Zone Creature Count: {}", count);
-
-        return true;
-    }
+        std::sort(mapExports.begin(), mapExports.end(), [](MapCreatureExport const& left, MapCreatureExport const& right) { return left.MapID < right.MapID; });
 
-    static bool HandleWriteZoneCreatures(ChatHandler* handler, Optional<PlayerIdentifier> target)
-    {
-        Player* player = handler->GetSession()->GetPlayer();
-        uint32 mapID = player->GetMapId();
-       
-        LOG_INFO("server.loading", "= Writing Creature Data ===========================================");
-        vector<string> outputLines;
-        for (auto& creatureReference : creatureReferences)
+        size_t mapCount = mapExports.size();
+        bool isQueued = exportWriter.TryEnqueue(player->GetGUID().GetRawValue(), [writeText, writeBinary, mapExports = std::move(mapExports), rowCount]() mutable
         {
-            if (player->GetMapId() == creatureReference.MapID)
+            designOutput.Write("= Writing Creature Data For All Maps ===========================================");
+            auto startTime = std::chrono::steady_clock::now();
+            workerPool.ParallelFor(mapExports.size(), 1, [&](size_t beginMap, size_t endMap, size_t /*workerIndex*/)
+            {
+                for (size_t mapIndex = beginMap; mapIndex < endMap; ++mapIndex)
+                {
+                    MapCreatureExport& mapExport = mapExports[mapIndex];
+                    UnscaleCreatureExportRows(mapExport.ExportRows, mapExport.WorldScale);
+                    if (writeText)
+                        mapExport.ByteCount += WriteCreatureTextExport(mapExport.MapID, mapExport.ExportRows, designOutput);
+                    if (writeBinary)
+                    {
+                        mapExport.ByteCount += WriteCreatureBinaryExport(mapExport.MapID, mapExport.WorldScale, mapExport.ExportRows);
+                        std::remove(GetCreatureDeltaFileName(mapExport.MapID).c_str());
+                    }
+                }
+            });
+            auto elapsedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+            string summary;
+            size_t byteCount = 0;
+            for (MapCreatureExport const& mapExport : mapExports)
             {
-                string outputLine;
-                outputLine += creatureReference.Name + "," + creatureReference.SubName + ",";
-                outputLine += RoundVal(creatureReference.CreaturePtr->GetPositionZ() / WorldScale, 6) + ",";
-                outputLines.push_back(outputLine);
-                LOG_INFO("server.loading", outputLine);
+                summary += fmt::format("Map {}: {} creatures, {} bytes\n", mapExport.MapID, mapExport.ExportRows.size(), mapExport.ByteCount);
+                byteCount += mapExport.ByteCount;
             }
+            summary += fmt::format("Done writing {} creatures across {} maps ({} bytes) in {} ms", rowCount, mapExports.size(), byteCount, elapsedMilliseconds);
+            return summary;
+        });
+
+        if (!isQueued)
+        {
+            handler->PSendSysMessage("Export queue is full, try again once the current exports finish");
+            return false;
         }
-        OutputFile outputFile;
-        string fileName = ConvertNumberToString(mapID) + ".txt";
-        outputFile.WriteLines(fileName, outputLines);
-        LOG_INFO("server.loading", "Done writing creatures");
+        handler->PSendSysMessage("Queued {} creatures across {} maps for export", rowCount, mapCount);
+
+        if (writeBinary)
+            for (uint32 mapID : GetCreatureRegistry().GetMapIDs())
+                GetCreatureRegistry().ClearChangesInMap(mapID);
 
         return true;
     }
@@ -447,17 +1663,8 @@ public:
         //    RoundVal((object->GetPositionX() / WorldScale) - 0.5f, 6), RoundVal((object->GetPositionY() / WorldScale) - 0.5f, 6), RoundVal((object->GetPositionZ() / WorldScale) - 0.5f, 6));
         //LOG_INFO("server.loading", "Orientation: {}f", RoundVal(object->GetOrientation(), 6));
 
-        static string priorText;
-        bool clearAfter = true;
-        if (priorText.size() == 0)
-            clearAfter = false;
-        else
-            priorText.append("|");
-        priorText.append(fmt::format("{}|{}|{}|{} scale:{}", RoundVal(object->GetPositionX() / WorldScale, 6), RoundVal(object->GetPositionY() / WorldScale, 6), RoundVal(object->GetPositionZ() / WorldScale, 6), RoundVal(object->GetOrientation(), 6), WorldScale));
-        handler->PSendSysMessage(priorText);
-        LOG_INFO("server.loading", priorText);
-        if (clearAfter == true)
-            priorText.clear();
+        CaptureDGPSPoint(captureState, captureJournal, designOutput, worldScales.GetScale(object->GetMapId()), object->GetPositionX(), object->GetPositionY(),
+            object->GetPositionZ(), object->GetOrientation(), ReplyTo(handler));
 
         return true;
     }
@@ -476,12 +1683,16 @@ public:
             return false;
         }
 
-        Player* player = handler->GetSession()->GetPlayer();
+        // The spawn ID needs a creature, not just any unit
         Creature* creature = handler->getSelectedCreature();
+        if (!creature)
+        {
+            return false;
+        }
 
-        string text = fmt::format("{}|{}|{}|{}", creature->GetSpawnId(), RoundVal(player->GetPositionX() / WorldScale, 6), RoundVal(player->GetPositionY() / WorldScale, 6), RoundVal(player->GetPositionZ() / WorldScale, 6));
-        handler->PSendSysMessage(text);
-        LOG_INFO("server.loading", text);
+        Player* player = handler->GetSession()->GetPlayer();
+        ReportSGPSPoint(designOutput, creature->GetSpawnId(), worldScales.GetScale(player->GetMapId()), player->GetPositionX(), player->GetPositionY(),
+            player->GetPositionZ(), ReplyTo(handler));
 
         return true;
     }
@@ -510,66 +1721,140 @@ public:
             return false;
         }
 
-        // Save coordinates
-        float curX = object->GetPositionX();
-        float curY = object->GetPositionY();
-        float curZ = object->GetPositionZ();
+        CaptureLiquidPlaneNode(captureState, captureJournal, designOutput, object->GetPositionX(), object->GetPositionY(), object->GetPositionZ(), ReplyTo(handler));
+        return true;
+    }
 
-        if (curLiquidPlaneStep == LiquidPlaneStep::STEP_0_SOUTH_HEIGHT)
+    static void TakeScannedLiquidPlanes()
+    {
+        std::lock_guard<std::mutex> lock(scannedLiquidPlanesLock);
+        for (LiquidPlane& scannedLiquidPlane : scannedLiquidPlanes)
         {
-            LOG_INFO("server.loading", "Starting new liquid plane, begining with south and low");
-            handler->PSendSysMessage("Starting new liquid plane, begining with south and low");
-            curLiquidPlane.seCornerX = curX - 0.01f;
-            curLiquidPlane.bottomZ = curZ - 0.001f;
-            LOG_INFO("server.loading", "Captured low height and south edge, next is west");
-            handler->PSendSysMessage("Captured low height and south edge, next is west");
-            curLiquidPlaneStep = LiquidPlaneStep::STEP_1_WEST;
+            JournalCapture(captureJournal, CAPTURE_LIQUID_PLANE, { scannedLiquidPlane.nwCornerX, scannedLiquidPlane.nwCornerY, scannedLiquidPlane.topZ,
+                scannedLiquidPlane.seCornerX, scannedLiquidPlane.seCornerY, scannedLiquidPlane.bottomZ }, scannedLiquidPlane.slantType);
+            captureState.LiquidPlanes.push_back(std::move(scannedLiquidPlane));
         }
-        else if (curLiquidPlaneStep == LiquidPlaneStep::STEP_1_WEST)
-        {
-            curLiquidPlane.nwCornerY = curY;
-            LOG_INFO("server.loading", "Captured west, next is east");
-            handler->PSendSysMessage("Captured west, next is east");
+        scannedLiquidPlanes.clear();
+    }
 
-            curLiquidPlaneStep = LiquidPlaneStep::STEP_2_EAST;
-        }
-        else if (curLiquidPlaneStep == LiquidPlaneStep::STEP_2_EAST)
+    // .lpscan minX minY maxX maxY step [minSamples]
+    // Samples the area for water above ground and adds a plane per body of water, for .lpwrite
+    static bool HandleLiquidPlaneScanCommand(ChatHandler* handler, float minX, float minY, float maxX, float maxY, float step, Optional<uint32> minSampleCount)
+    {
+        uint64 const maxSampleCount = 16 * 1024 * 1024;
+
+        Player* player = handler->GetSession()->GetPlayer();
+        if (step <= 0)
         {
-            curLiquidPlane.seCornerY = curY;
-            LOG_INFO("server.loading", "Captured east, next is north + height");
-            handler->PSendSysMessage("Captured east, next is north + height");
-            curLiquidPlaneStep = LiquidPlaneStep::STEP_3_NORTH_HEIGHT;
+            handler->PSendSysMessage("Step must be greater than zero");
+            return false;
         }
-        else if (curLiquidPlaneStep == LiquidPlaneStep::STEP_3_NORTH_HEIGHT)
+        if (minX > maxX)
+            std::swap(minX, maxX);
+        if (minY > maxY)
+            std::swap(minY, maxY);
+
+        LiquidScanGrid grid;
+        grid.Width = uint32((maxX - minX) / step) + 1;
+        grid.Height = uint32((maxY - minY) / step) + 1;
+        grid.MinX = minX;
+        grid.MinY = minY;
+        grid.Step = step;
+        if (uint64(grid.Width) * uint64(grid.Height) > maxSampleCount)
         {
-            curLiquidPlane.nwCornerX = curX;
-            curLiquidPlane.topZ = curZ;
-            liquidPlanes.push_back(curLiquidPlane);
-            curLiquidPlane.Reset();
-            curLiquidPlane.seCornerX = curX - 0.01f;
-            curLiquidPlane.bottomZ = curZ - 0.001f;
-            LOG_INFO("server.loading", "Captured north and high height for current plane, south and low for next plane. Next is west.");
-            handler->PSendSysMessage("Captured north and high height for current plane, south and low for next plane. Next is west.");
-            curLiquidPlaneStep = LiquidPlaneStep::STEP_1_WEST;
+            handler->PSendSysMessage("{} x {} samples is too many, use a larger step or a smaller area", grid.Width, grid.Height);
+            return false;
         }
 
+        LiquidScanSettings settings;
+        if (minSampleCount)
+            settings.MinSampleCount = *minSampleCount;
+
+        uint32 width = grid.Width;
+        uint32 height = grid.Height;
+        std::shared_ptr<TerrainSampleJob> job = std::make_shared<TerrainSampleJob>();
+        job->RequesterGUID = player->GetGUID().GetRawValue();
+        job->Sampler.Start(std::move(grid), MAX_HEIGHT, SIZE_OF_GRIDS);
+        auto startTime = std::chrono::steady_clock::now();
+        job->Finish = [settings, startTime](LiquidScanGrid& sampledGrid)
+        {
+            vector<LiquidPlane> foundPlanes;
+            ExtractLiquidPlanes(sampledGrid, settings, foundPlanes);
+            size_t planeCount = foundPlanes.size();
+            {
+                std::lock_guard<std::mutex> lock(scannedLiquidPlanesLock);
+                for (LiquidPlane& foundPlane : foundPlanes)
+                    scannedLiquidPlanes.push_back(std::move(foundPlane));
+            }
+
+            auto elapsedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+            return fmt::format("Liquid scan of {} x {} samples found {} planes in {} ms, .lpwrite to output them", sampledGrid.Width, sampledGrid.Height, planeCount, elapsedMilliseconds);
+        };
+
+        if (!terrainSampleScheduler.Enqueue(player->GetMap(), std::move(job)))
+        {
+            handler->PSendSysMessage("Too many terrain samplings are waiting, try again once the current ones finish");
+            return false;
+        }
+        handler->PSendSysMessage("Scanning {} x {} samples for liquid over the next map updates on {} threads", width, height, workerPool.GetWorkerCount());
         return true;
     }
 
     static bool HandleLiquidPlaneWriteCommand(ChatHandler* handler, Optional<PlayerIdentifier> target)
     {
-        LOG_INFO("server.loading", " == Writing Planes == ");
-        for (auto& waterPlane : liquidPlanes)
-            waterPlane.ToString();
+        TakeScannedLiquidPlanes();
+        designOutput.WriteOrWait(" == Writing Planes == ");
+        for (auto& waterPlane : captureState.LiquidPlanes)
+            designOutput.WriteOrWait(waterPlane.ToString());
         return true;
     }
 
     static bool HandleLiquidPlaneClearCommand(ChatHandler* handler, Optional<PlayerIdentifier> target)
     {
-        curLiquidPlaneStep = LiquidPlaneStep::STEP_0_SOUTH_HEIGHT;
-        curLiquidPlane.Reset();
-        liquidPlanes.clear();
-        LOG_INFO("server.loading", " == Planes Cleared == ");
+        TakeScannedLiquidPlanes();
+        ClearLiquidPlanes(captureState);
+        JournalCapture(captureJournal, CAPTURE_LIQUID_CLEAR);
+        designOutput.Write(" == Planes Cleared == ");
+        return true;
+    }
+
+    // Rewrites the capture journal as the shortest one that rebuilds the current captures
+    static bool HandleJournalCheckpointCommand(ChatHandler* handler)
+    {
+        if (!captureJournal.IsOpen())
+        {
+            handler->PSendSysMessage("The capture journal is off, set DesignCommands.Journal.File to turn it on");
+            return false;
+        }
+
+        TakeScannedLiquidPlanes();
+        CaptureJournalStats stats = captureJournal.GetStats();
+        string checkpoint = FormatCaptureCheckpoint(captureState, zoneLinePairs);
+        if (!captureJournal.Rewrite(checkpoint))
+        {
+            handler->PSendSysMessage("Could not write the checkpoint, the journal is unchanged");
+            return false;
+        }
+        handler->PSendSysMessage("Checkpointed {} liquid planes and {} zone lines into {} bytes. {} records were written in {} syncs before it{}",
+            captureState.LiquidPlanes.size(), captureState.ZoneLineCaptures.size(), checkpoint.size(), stats.RecordsWritten, stats.Syncs,
+            stats.IsFailed ? ", and some writes failed" : "");
+        return true;
+    }
+
+    // Empties the capture journal. Captures in memory are kept, but a restart no longer brings them back.
+    static bool HandleJournalTruncateCommand(ChatHandler* handler)
+    {
+        if (!captureJournal.IsOpen())
+        {
+            handler->PSendSysMessage("The capture journal is off, set DesignCommands.Journal.File to turn it on");
+            return false;
+        }
+        if (!captureJournal.Rewrite(CaptureJournalHeader))
+        {
+            handler->PSendSysMessage("Could not truncate the journal");
+            return false;
+        }
+        handler->PSendSysMessage("Capture journal truncated, use .journalcheckpoint to journal the current captures again");
         return true;
     }
 
@@ -597,235 +1882,79 @@ public:
             return false;
         }
 
-        // Save coordinates
-        float curX = object->GetPositionX();
-        float curY = object->GetPositionY();
-        float curZ = object->GetPositionZ();
-
-        ////**************
-        // Qeynos2 (North Qeynos) is to the south
-        // Strings
-        std::string thisZoneName = "qeynos2";
-        std::string thisZonePortInOrientation = "ZoneLineOrientationType.South";
-
-        std::string otherZoneName = "qeytoqrg";
-        std::string otherZonePortInOrientation = "ZoneLineOrientationType.North";
-
-        // Working coordinates
-        float thisZoneCurX = curX;
-        float thisZoneCurY = curY;
-        float thisZoneCurZ = curZ;
-
-        float otherZoneCurX = -310.758850f;
-        float otherZoneCurY = curY + 0.439697f;
-        float otherZoneCurZ = -7.843740f;
-
-        // Box Containers
-        float thisZoneBoxTopX = thisZoneCurX + 50.0f;
-        float thisZoneBoxBottomX = thisZoneCurX + 20.0f;
-
-        float thisZoneBoxTopY = thisZoneCurY + 10.0f;
-        float thisZoneBoxBottomY = thisZoneCurY - 10.0f;
-
-        float thisZoneBoxTopZ = 200.0f;
-        float thisZoneBoxBottomZ = -100.00f;
-
-        float otherZoneBoxTopX = otherZoneCurX - 20.0f;
-        float otherZoneBoxBottomX = otherZoneCurX - 50.0f;
-
-        float otherZoneBoxTopY = otherZoneCurY + 10.0f;
-        float otherZoneBoxBottomY = otherZoneCurY - 10.0f;
-
-        float otherZoneBoxTopZ = 0;
-        float otherZoneBoxBottomZ = 0;
-
-        // Generate the strings
-        std::string thisZoneBoxTopString = RoundVals(thisZoneBoxTopX, thisZoneBoxTopY, thisZoneBoxTopZ, 6);
-        std::string thisZoneBoxBottomString = RoundVals(thisZoneBoxBottomX, thisZoneBoxBottomY, thisZoneBoxBottomZ, 6);
-        std::string otherZoneTargetPosition = RoundVals(otherZoneCurX, otherZoneCurY, otherZoneCurZ, 6);
-        std::ostringstream thisZoneLineStream;
-        thisZoneLineStream << thisZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + otherZoneName + "\", " + otherZoneTargetPosition + ", " + otherZonePortInOrientation + ", " + thisZoneBoxTopString + ", " + thisZoneBoxBottomString + "); \n";
-        thisZoneLineCoordinates = thisZoneLineStream.str();
-
-        std::string otherZoneBoxTopString = RoundVals(otherZoneBoxTopX, otherZoneBoxTopY, otherZoneBoxTopZ, 6);
-        std::string otherZoneBoxBottomString = RoundVals(otherZoneBoxBottomX, otherZoneBoxBottomY, otherZoneBoxBottomZ, 6);
-        std::string thisZoneTargetPosition = RoundVals(thisZoneCurX, thisZoneCurY, thisZoneCurZ, 6);
-        std::ostringstream otherZoneLineStream;
-        otherZoneLineStream << otherZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + thisZoneName + "\", " + thisZoneTargetPosition + ", " + thisZonePortInOrientation + ", " + otherZoneBoxTopString + ", " + otherZoneBoxBottomString + "); \n";
-        otherZoneLineCoordinates = otherZoneLineStream.str();
-        ////******************
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-        /////// Oasis of marr and North Ro
-        //// Strings
-        //std::string thisZoneName = "oasis";
-        //std::string thisZonePortInOrientation = "ZoneLineOrientationType.South";
-
-        //std::string otherZoneName = "nro";
-        //std::string otherZonePortInOrientation = "ZoneLineOrientationType.North";
-
-        //// Working coordinates
-        //float thisZoneCurX = curX;
-        //float thisZoneCurY = curY;
-        //float thisZoneCurZ = curZ;
-
-        //float otherZoneCurX = 0;
-        //float otherZoneCurY = 0;
-        //float otherZoneCurZ = 0;
-
-        //// Box Containers
-        //float thisZoneBoxTopX = thisZoneCurX - 20.0f;
-        //float thisZoneBoxTopY = thisZoneCurY + 10.0f;
-        //float thisZoneBoxTopZ = 300.0f;
-        //float thisZoneBoxBottomX = thisZoneCurX + 50.0f;
-        //float thisZoneBoxBottomY = thisZoneCurY - 10.0f;
-        //float thisZoneBoxBottomZ = -200.00f;
-
-        //float otherZoneBoxTopX = 0;
-        //float otherZoneBoxTopY = 0;
-        //float otherZoneBoxTopZ = 0;
-        //float otherZoneBoxBottomX = 0;
-        //float otherZoneBoxBottomY = 0;
-        //float otherZoneBoxBottomZ = 0;
-
-        //// Generate the strings
-        //std::string thisZoneBoxTopString = RoundVals(thisZoneBoxTopX, thisZoneBoxTopY, thisZoneBoxTopZ, 6);
-        //std::string thisZoneBoxBottomString = RoundVals(thisZoneBoxBottomX, thisZoneBoxBottomY, thisZoneBoxBottomZ, 6);
-        //std::string otherZoneTargetPosition = RoundVals(otherZoneCurX, otherZoneCurY, otherZoneCurZ, 6);
-        //std::ostringstream thisZoneLineStream;
-        //thisZoneLineStream << thisZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + otherZoneName + "\", " + otherZoneTargetPosition + ", " + otherZonePortInOrientation + ", " + thisZoneBoxTopString + ", " + thisZoneBoxBottomString + "); \n";
-        //thisZoneLineCoordinates = thisZoneLineStream.str();
-
-        //std::string otherZoneBoxTopString = RoundVals(otherZoneBoxTopX, otherZoneBoxTopY, otherZoneBoxTopZ, 6);
-        //std::string otherZoneBoxBottomString = RoundVals(otherZoneBoxBottomX, otherZoneBoxBottomY, otherZoneBoxBottomZ, 6);
-        //std::string thisZoneTargetPosition = RoundVals(thisZoneCurX, thisZoneCurY, thisZoneCurZ, 6);
-        //std::ostringstream otherZoneLineStream;
-        //otherZoneLineStream << otherZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + thisZoneName + "\", " + thisZoneTargetPosition + ", " + thisZonePortInOrientation + ", " + otherZoneBoxTopString + ", " + otherZoneBoxBottomString + "); \n";
-        //otherZoneLineCoordinates = otherZoneLineStream.str();
-
-        /////// ------
-        //// NRO - EFP, zones are north (EFP) and south (NPO) of one another
-        //// Strings
-        //std::string thisZoneName = "nro";
-        //std::string thisZonePortInOrientation = "ZoneLineOrientationType.South";
-
-        //std::string otherZoneName = "freporte";
-        //std::string otherZonePortInOrientation = "ZoneLineOrientationType.North";
+        return CaptureZoneLine(captureState, captureJournal, zoneLinePairs, object->GetPositionX(), object->GetPositionY(), object->GetPositionZ(), ReplyTo(handler));
+    }
 
-        //// Working coordinates
-        //float thisZoneCurX = curX;
-        //float thisZoneCurY = curY;
-        //float thisZoneCurZ = curZ;
+    // .zlpair lists the loaded pairs, .zlpair <name> picks the one .zlcapture uses
+    static bool HandleZoneLinePairCommand(ChatHandler* handler, Optional<std::string_view> pairName)
+    {
+        if (!pairName)
+        {
+            for (size_t pairIndex = 0; pairIndex < zoneLinePairs.size(); ++pairIndex)
+                handler->PSendSysMessage("{}{} ({} to {})", pairIndex == captureState.SelectedZoneLinePair ? "* " : "  ", zoneLinePairs[pairIndex].Name,
+                    zoneLinePairs[pairIndex].ThisZoneName, zoneLinePairs[pairIndex].OtherZoneName);
+            return true;
+        }
 
-        //float otherZoneCurX = -1316.303711f;
-        //float otherZoneCurY = thisZoneCurY - 1033.602013f;
-        //float otherZoneCurZ = -55.968739f;
+        for (size_t pairIndex = 0; pairIndex < zoneLinePairs.size(); ++pairIndex)
+        {
+            if (zoneLinePairs[pairIndex].Name == *pairName)
+            {
+                captureState.SelectedZoneLinePair = uint32(pairIndex);
+                JournalCapture(captureJournal, CAPTURE_ZONE_LINE_PAIR, {}, zoneLinePairs[pairIndex].Name);
+                handler->PSendSysMessage("Zone line captures now use {}", zoneLinePairs[pairIndex].Name);
+                return true;
+            }
+        }
+        handler->PSendSysMessage("No zone line pair named {}", *pairName);
+        return false;
+    }
 
-        //// Box Containers
-        //float thisZoneBoxTopX = thisZoneCurX + 50.0f;
-        //float thisZoneBoxTopY = thisZoneCurY + 10.0f;
-        //float thisZoneBoxTopZ = 200.0f;
-        //float thisZoneBoxBottomX = thisZoneCurX + 20.0f;
-        //float thisZoneBoxBottomY = thisZoneCurY - 10.0f;
-        //float thisZoneBoxBottomZ = -100.00f;
+    // .zlwrite logs the zone lines, .zlwrite file writes them to zonelines.txt instead
+    static bool HandleZoneLineWriteCommand(ChatHandler* handler, Optional<std::string_view> destination)
+    {
+        bool writeFile = destination && *destination == "file";
+        if (destination && !writeFile)
+            return false;
 
-        //float otherZoneBoxTopX = otherZoneCurX - 20.0f;
-        //float otherZoneBoxTopY = otherZoneCurY + 10.0f;
-        //float otherZoneBoxTopZ = 200.0f;
-        //float otherZoneBoxBottomX = otherZoneCurX - 50.0f;
-        //float otherZoneBoxBottomY = otherZoneCurY - 10.0f;
-        //float otherZoneBoxBottomZ = -100.00f;
+        vector<ZoneLineBlock> zoneLineBlocks;
+        RenderZoneLineCaptures(zoneLinePairs, captureState.ZoneLineCaptures, zoneLineBlocks);
 
-        //// Generate the strings
-        //std::string thisZoneBoxTopString = RoundVals(thisZoneBoxTopX, thisZoneBoxTopY, thisZoneBoxTopZ, 6);
-        //std::string thisZoneBoxBottomString = RoundVals(thisZoneBoxBottomX, thisZoneBoxBottomY, thisZoneBoxBottomZ, 6);
-        //std::string otherZoneTargetPosition = RoundVals(otherZoneCurX, otherZoneCurY, otherZoneCurZ, 6);
-        //std::ostringstream thisZoneLineStream;
-        //thisZoneLineStream << thisZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + otherZoneName + "\", " + otherZoneTargetPosition + ", " + otherZonePortInOrientation + ", " + thisZoneBoxTopString + ", " + thisZoneBoxBottomString + "); \n";
-        //thisZoneLineCoordinates = thisZoneLineStream.str();
-
-        //std::string otherZoneBoxTopString = RoundVals(otherZoneBoxTopX, otherZoneBoxTopY, otherZoneBoxTopZ, 6);
-        //std::string otherZoneBoxBottomString = RoundVals(otherZoneBoxBottomX, otherZoneBoxBottomY, otherZoneBoxBottomZ, 6);
-        //std::string thisZoneTargetPosition = RoundVals(thisZoneCurX, thisZoneCurY, thisZoneCurZ, 6);
-        //std::ostringstream otherZoneLineStream;
-        //otherZoneLineStream << otherZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + thisZoneName + "\", " + thisZoneTargetPosition + ", " + thisZonePortInOrientation + ", " + otherZoneBoxTopString + ", " + otherZoneBoxBottomString + "); \n";
-        //otherZoneLineCoordinates = otherZoneLineStream.str();
-
-
-        ////**************
-        //// This is a backup of West Freeport - East Commons  (Example of east/west)
-        //// Strings
-        //std::string thisZoneName = "ecommons";
-        //std::string thisZonePortInOrientation = "ZoneLineOrientationType.West";
-
-        //std::string otherZoneName = "freportw";
-        //std::string otherZonePortInOrientation = "ZoneLineOrientationType.East";
-
-        //// Working coordinates
-        //float thisZoneCurX = curX;
-        //float thisZoneCurY = curY;
-        //float thisZoneCurZ = curZ;
-
-        //float otherZoneCurX = thisZoneCurX + 0.772155f;
-        //float otherZoneCurY = 791.873230f;
-        //float otherZoneCurZ = -27.999950f;
-
-        //// Box Containers
-        //float thisZoneBoxTopX = thisZoneCurX + 10.0f;
-        //float thisZoneBoxTopY = thisZoneCurY - 20.0f;
-        //float thisZoneBoxTopZ = 200.0f;
-        //float thisZoneBoxBottomX = thisZoneCurX - 10.0f;
-        //float thisZoneBoxBottomY = thisZoneCurY - 50.0f;
-        //float thisZoneBoxBottomZ = -100.00f;
-
-        //float otherZoneBoxTopX = otherZoneCurX + 10.0f;
-        //float otherZoneBoxTopY = otherZoneCurY + 50.0f;
-        //float otherZoneBoxTopZ = 200.0f;
-        //float otherZoneBoxBottomX = otherZoneCurX - 10.0f;
-        //float otherZoneBoxBottomY = otherZoneCurY + 20.0f;
-        //float otherZoneBoxBottomZ = -100.00f;
-
-        //// Generate the strings
-        //std::string thisZoneBoxTopString = RoundVals(thisZoneBoxTopX, thisZoneBoxTopY, thisZoneBoxTopZ, 6);
-        //std::string thisZoneBoxBottomString = RoundVals(thisZoneBoxBottomX, thisZoneBoxBottomY, thisZoneBoxBottomZ, 6);
-        //std::string otherZoneTargetPosition = RoundVals(otherZoneCurX, otherZoneCurY, otherZoneCurZ, 6);
-        //std::ostringstream thisZoneLineStream;
-        //thisZoneLineStream << thisZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + otherZoneName + "\", " + otherZoneTargetPosition + ", " + otherZonePortInOrientation + ", " + thisZoneBoxTopString + ", " + thisZoneBoxBottomString + "); \n";
-        //thisZoneLineCoordinates = thisZoneLineStream.str();
-
-        //std::string otherZoneBoxTopString = RoundVals(otherZoneBoxTopX, otherZoneBoxTopY, otherZoneBoxTopZ, 6);
-        //std::string otherZoneBoxBottomString = RoundVals(otherZoneBoxBottomX, otherZoneBoxBottomY, otherZoneBoxBottomZ, 6);
-        //std::string thisZoneTargetPosition = RoundVals(thisZoneCurX, thisZoneCurY, thisZoneCurZ, 6);
-        //std::ostringstream otherZoneLineStream;
-        //otherZoneLineStream << otherZoneLineCoordinates << "zoneProperties.AddZoneLineBox(\"" + thisZoneName + "\", " + thisZoneTargetPosition + ", " + thisZonePortInOrientation + ", " + otherZoneBoxTopString + ", " + otherZoneBoxBottomString + "); \n";
-        //otherZoneLineCoordinates = otherZoneLineStream.str();
-        //////******************
+        if (!writeFile)
+        {
+            designOutput.WriteOrWait("");
+            for (ZoneLineBlock const& zoneLineBlock : zoneLineBlocks)
+            {
+                designOutput.WriteOrWait(zoneLineBlock.ThisZoneLines);
+                designOutput.WriteOrWait(zoneLineBlock.OtherZoneLines);
+            }
+            return true;
+        }
 
-        return true;
-    }
+        vector<string> textRows;
+        textRows.reserve(zoneLineBlocks.size() * 4);
+        for (ZoneLineBlock& zoneLineBlock : zoneLineBlocks)
+        {
+            ZoneLinePairDefinition const& pair = zoneLinePairs[zoneLineBlock.PairIndex];
+            textRows.push_back("// " + pair.ThisZoneName + " to " + pair.OtherZoneName);
+            textRows.push_back(std::move(zoneLineBlock.ThisZoneLines));
+            textRows.push_back("// " + pair.OtherZoneName + " to " + pair.ThisZoneName);
+            textRows.push_back(std::move(zoneLineBlock.OtherZoneLines));
+        }
 
-    static bool HandleZoneLineWriteCommand(ChatHandler* handler, Optional<PlayerIdentifier> target)
-    {
-        LOG_INFO("server.loading", "");
-        LOG_INFO("server.loading", "{}", thisZoneLineCoordinates);
-        LOG_INFO("server.loading", "{}", otherZoneLineCoordinates);
+        size_t captureCount = captureState.ZoneLineCaptures.size();
+        bool isQueued = exportWriter.TryEnqueue(handler->GetSession()->GetPlayer()->GetGUID().GetRawValue(), [textRows = std::move(textRows), captureCount]()
+        {
+            OutputFile outputFile;
+            outputFile.WriteLines("zonelines.txt", textRows);
+            return fmt::format("Wrote {} zone line captures to zonelines.txt", captureCount);
+        });
+        if (!isQueued)
+        {
+            handler->PSendSysMessage("Export queue is full, try again shortly");
+            return false;
+        }
+        handler->PSendSysMessage("Writing {} zone line captures to zonelines.txt", captureCount);
         return true;
     }
 
@@ -853,14 +1982,9 @@ public:
             return false;
         }
 
-        // Calc new position
-        float newX = object->GetPositionX() + 20.0f;
-        float newY = object->GetPositionY();
-        float newZ = object->GetPositionZ() + 30.0f;
-
         Player* player = handler->GetSession()->GetPlayer();
-        player->TeleportTo({ player->GetMapId(), {newX, newY, newZ, player->GetOrientation()} });
-        return true;
+        return StepZoneLineHigh(player->GetMapId(), object->GetPositionX(), object->GetPositionY(), object->GetPositionZ(), player->GetOrientation(),
+            PrefetchTeleportFor(player));
     }
 
     static bool HandleZoneLineStepLowCommand(ChatHandler* handler, Optional<PlayerIdentifier> target)
@@ -887,20 +2011,15 @@ public:
             return false;
         }
 
-        // Calc new position
-        float newX = object->GetPositionX();
-        float newY = object->GetPositionY() - 20.0f;
-        float newZ = object->GetPositionZ();
-
         Player* player = handler->GetSession()->GetPlayer();
-        player->TeleportTo({ player->GetMapId(), {newX, newY, newZ, player->GetOrientation()} });
-        return true;
+        return StepZoneLineLow(player->GetMapId(), object->GetPositionX(), object->GetPositionY(), object->GetPositionZ(), player->GetOrientation(),
+            PrefetchTeleportFor(player));
     }
 
     static bool HandleZoneLineClearCommand(ChatHandler* handler, Optional<PlayerIdentifier> target)
     {
-        thisZoneLineCoordinates = "";
-        otherZoneLineCoordinates = "";
+        captureState.ZoneLineCaptures.clear();
+        JournalCapture(captureJournal, CAPTURE_ZONE_LINE_CLEAR);
         return true;
     }
 };
@@ -920,3 +2039,13 @@ void AddDesignCommandsPlayerScript()
     new DesignCommandsPlayerScript();
 }
 
+void AddDesignCommandsAllMapScript()
+{
+    new DesignCommandsAllMapScript();
+}
+
+void AddDesignCommandsWorldScript()
+{
+    new DesignCommandsWorldScript();
+}
+
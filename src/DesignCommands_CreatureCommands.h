@@ -0,0 +1,362 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_CREATURECOMMANDS_H
+#define DESIGNCOMMANDS_CREATURECOMMANDS_H
+
+#include "DesignCommands_CreatureExport.h"
+#include "DesignCommands_CreatureRegistry.h"
+#include "DesignCommands_EventQueue.h"
+#include "DesignCommands_Format.h"
+#include "DesignCommands_NavAudit.h"
+#include "DesignCommands_OutputLog.h"
+#include "DesignCommands_Terrain.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The creature commands without the chat side, so the bench can drive them
+// with its stub creatures and map. Templated on the creature type only so
+// that the accessors are looked up where the type is complete. On top of the
+// calls listed in DesignCommands_Terrain.h, a creature needs GetGUID(),
+// GetMapId, GetInstanceId, GetEntry, GetName, GetCreatureTemplate, CanSwim,
+// SendMovementFlagUpdate and GetMotionMaster()->MoveFall().
+// reply(std::string const&) shows a line to the GM.
+
+enum CreatureRegistryEventType
+{
+    REGISTRY_EVENT_ADD,
+    REGISTRY_EVENT_REMOVE,
+    REGISTRY_EVENT_MOVED        // Position changed in place, for delta exports
+};
+
+class CreatureRegistryEvent
+{
+public:
+    CreatureRegistryEventType Type = REGISTRY_EVENT_ADD;
+    Creature* CreaturePtr = nullptr;
+    CreatureReference Reference;
+};
+
+// Spawns and despawns arrive on map update threads, so they are only queued
+// there. The world thread owns the registry and applies the queue before each
+// read. Maps do not update while the world thread runs commands, so a creature
+// pointer in the registry is still live when it is read after a drain.
+template <typename CreatureType>
+class CreatureRegistryFeed
+{
+public:
+    // Any thread
+    void OnAdd(CreatureType* creature)
+    {
+        CreatureRegistryEvent registryEvent = MakeEvent(REGISTRY_EVENT_ADD, creature);
+        registryEvent.CreaturePtr = creature;
+        registryEvent.Reference.Entry = creature->GetEntry();
+        registryEvent.Reference.SpawnID = creature->GetSpawnId();
+        events.Push(std::move(registryEvent));
+    }
+
+    // Any thread
+    void OnRemove(CreatureType* creature)
+    {
+        events.Push(MakeEvent(REGISTRY_EVENT_REMOVE, creature));
+    }
+
+    // Any thread, once the new position is final
+    void OnMoved(CreatureType* creature)
+    {
+        events.Push(MakeEvent(REGISTRY_EVENT_MOVED, creature));
+    }
+
+    // World thread only
+    void Apply()
+    {
+        registry.AssertOwnerThread();
+        events.Drain([this](CreatureRegistryEvent&& registryEvent)
+        {
+            CreatureReference const& reference = registryEvent.Reference;
+            if (registryEvent.Type == REGISTRY_EVENT_ADD)
+                registry.Add(registryEvent.CreaturePtr, reference);
+            else if (registryEvent.Type == REGISTRY_EVENT_REMOVE)
+                registry.Remove(reference.MapID, reference.InstanceID, reference.GUID);
+            else
+                registry.MarkMoved(reference.MapID, reference.InstanceID, reference.GUID, reference.PositionX, reference.PositionY);
+        });
+    }
+
+    // World thread only
+    CreatureRegistry& GetRegistry()
+    {
+        Apply();
+        // Maps are idle while the world thread reads, so nothing can be half pushed
+        assert(events.IsEmpty() && "Creature events pushed while the registry is read");
+        return registry;
+    }
+
+private:
+    static CreatureRegistryEvent MakeEvent(CreatureRegistryEventType type, CreatureType* creature)
+    {
+        CreatureRegistryEvent registryEvent;
+        registryEvent.Type = type;
+        registryEvent.Reference.GUID = creature->GetGUID().GetRawValue();
+        registryEvent.Reference.MapID = creature->GetMapId();
+        registryEvent.Reference.InstanceID = creature->GetInstanceId();
+        registryEvent.Reference.PositionX = creature->GetPositionX();
+        registryEvent.Reference.PositionY = creature->GetPositionY();
+        return registryEvent;
+    }
+
+    EventQueue<CreatureRegistryEvent> events;
+    CreatureRegistry registry;
+};
+
+// Writes "name,subname,x,y,z" if row echo is on
+template <typename CreatureType>
+void WriteCreatureRow(OutputLog& output, CreatureType* creature)
+{
+    if (!output.IsEchoingRows())
+        return;
+    std::string outputLine = creature->GetName();
+    outputLine += ',';
+    outputLine += creature->GetCreatureTemplate()->SubName;
+    outputLine += ',';
+    AppendRoundVal(outputLine, creature->GetPositionX());
+    outputLine += ',';
+    AppendRoundVal(outputLine, creature->GetPositionY());
+    outputLine += ',';
+    AppendRoundVal(outputLine, creature->GetPositionZ());
+    output.Write(outputLine);
+}
+
+// Lists the creatures within radius of a point on a map. Returns false, and
+// writes nothing, unless the radius is a number of yards, 0 or more. Larger
+// radii are cut down to maxRadius, which is passed back in radius.
+template <typename CreatureType>
+bool ListCreaturesNear(CreatureRegistryFeed<CreatureType>& feed, OutputLog& output, uint32_t mapID, float centerX, float centerY,
+    float maxRadius, float& radius, size_t& outCount)
+{
+    if (!std::isfinite(radius) || radius < 0)
+        return false;
+    radius = std::min(radius, maxRadius);
+
+    std::string headerLine = "= Creatures Within ";
+    AppendExactFloat(headerLine, radius);
+    headerLine += " ===================================";
+    output.Write(headerLine);
+    outCount = 0;
+    feed.GetRegistry().ForEachInRadius(mapID, centerX, centerY, radius, [&output, &outCount](Creature* creature, CreatureReference const&)
+    {
+        WriteCreatureRow<CreatureType>(output, creature);
+        outCount++;
+    });
+    output.Write("Nearby Creature Count: " + std::to_string(outCount));
+    return true;
+}
+
+// Lists the creatures inside an XY box on a map, with the corners in either
+// order. Returns false, and writes nothing, if a corner is not a number.
+template <typename CreatureType>
+bool ListCreaturesInBox(CreatureRegistryFeed<CreatureType>& feed, OutputLog& output, uint32_t mapID, float minX, float minY,
+    float maxX, float maxY, size_t& outCount)
+{
+    if (!std::isfinite(minX) || !std::isfinite(minY) || !std::isfinite(maxX) || !std::isfinite(maxY))
+        return false;
+
+    output.Write("= Creatures In Box ===================================");
+    outCount = 0;
+    feed.GetRegistry().ForEachInBox(mapID, std::min(minX, maxX), std::min(minY, maxY), std::max(minX, maxX), std::max(minY, maxY),
+        [&output, &outCount](Creature* creature, CreatureReference const&)
+    {
+        WriteCreatureRow<CreatureType>(output, creature);
+        outCount++;
+    });
+    output.Write("Box Creature Count: " + std::to_string(outCount));
+    return true;
+}
+
+enum CreatureDeltaQueueResult
+{
+    CREATURE_DELTA_QUEUED,
+    CREATURE_DELTA_NO_CHANGES,
+    CREATURE_DELTA_QUEUE_FULL
+};
+
+// Hands the creatures changed and removed on a map since the last export to
+// queueWrite(changedRows, removedSpawnIDs), which returns false if the write
+// could not be queued. The changes stay tracked until they are queued, so a
+// full queue loses nothing.
+template <typename CreatureType, typename QueueWrite>
+CreatureDeltaQueueResult QueueCreatureDelta(CreatureRegistryFeed<CreatureType>& feed, uint32_t mapID, QueueWrite&& queueWrite,
+    size_t& outChangedCount, size_t& outRemovedCount)
+{
+    std::vector<CreatureExportRow> changedRows;
+    std::vector<uint32_t> removedSpawnIDs;
+    CreatureRegistry& registry = feed.GetRegistry();
+    changedRows.reserve(registry.CountChangedInMap(mapID));
+    registry.ForEachChangeInMap(mapID, [&changedRows](Creature* creature, CreatureReference const& creatureReference)
+    {
+        if (creatureReference.SpawnID != 0)
+            changedRows.push_back(MakeCreatureExportRow<CreatureType>(creature, creatureReference.Entry));
+    }, removedSpawnIDs);
+
+    outChangedCount = changedRows.size();
+    outRemovedCount = removedSpawnIDs.size();
+    if (changedRows.empty() && removedSpawnIDs.empty())
+        return CREATURE_DELTA_NO_CHANGES;
+    if (!queueWrite(std::move(changedRows), std::move(removedSpawnIDs)))
+        return CREATURE_DELTA_QUEUE_FULL;
+    registry.ClearChangesInMap(mapID);
+    return CREATURE_DELTA_QUEUED;
+}
+
+// Relocates the creature to its resolved Z with no motion generator, and sends
+// a heartbeat so clients that already see it pick up the new position
+template <typename TerrainMap, typename CreatureType>
+bool SnapCreature(TerrainMap* map, CreatureType* creature, GroundSnapRecord& outRecord)
+{
+    if (!SnapCreatureToGround(map, creature, creature->CanSwim(), outRecord))
+        return false;
+    outRecord.GUID = creature->GetGUID().GetRawValue();
+    outRecord.Entry = creature->GetEntry();
+    creature->SendMovementFlagUpdate();
+    return true;
+}
+
+// .npcup and .npcdown body. Moves the creature by zOffset and then drops it,
+// by falling or in snap mode by snapping. keepSnap(record) holds a snap for
+// .snapwrite.
+template <typename TerrainMap, typename CreatureType, typename KeepSnap>
+void DropCreature(CreatureRegistryFeed<CreatureType>& feed, TerrainMap* map, CreatureType* creature, float zOffset, bool isSnapMode, KeepSnap&& keepSnap)
+{
+    float oldZ = creature->GetPositionZ();
+    creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), oldZ + zOffset, creature->GetOrientation());
+    if (isSnapMode)
+    {
+        GroundSnapRecord snapRecord;
+        if (SnapCreature(map, creature, snapRecord))
+        {
+            snapRecord.OldZ = oldZ;
+            keepSnap(snapRecord);
+        }
+    }
+    else
+        creature->GetMotionMaster()->MoveFall();
+    feed.GetRegistry().MarkMoved(creature->GetMapId(), creature->GetInstanceId(), creature->GetGUID().GetRawValue(), creature->GetPositionX(), creature->GetPositionY());
+}
+
+// .npcsnap body, for the selected creature or nullptr
+template <typename TerrainMap, typename CreatureType, typename KeepSnap, typename Reply>
+bool SnapSelectedCreature(CreatureRegistryFeed<CreatureType>& feed, TerrainMap* map, CreatureType* creature, KeepSnap&& keepSnap, Reply&& reply)
+{
+    if (creature == nullptr)
+    {
+        reply("Select a creature to snap");
+        return false;
+    }
+
+    GroundSnapRecord snapRecord;
+    if (!SnapCreature(map, creature, snapRecord))
+    {
+        reply(std::string(creature->GetName()) + " is already on the ground, or there is no ground under it");
+        return true;
+    }
+    keepSnap(snapRecord);
+    feed.GetRegistry().MarkMoved(creature->GetMapId(), creature->GetInstanceId(), snapRecord.GUID, creature->GetPositionX(), creature->GetPositionY());
+    std::string snappedText = "Snapped " + std::string(creature->GetName()) + " from z ";
+    AppendRoundVal(snappedText, snapRecord.OldZ);
+    snappedText += " to ";
+    AppendRoundVal(snappedText, snapRecord.NewZ);
+    reply(snappedText);
+    return true;
+}
+
+// .navaudit body. audit(spawns, results) runs the navmesh queries and returns
+// whether reachability was checked. The report is sorted and written to
+// <mapID>.navaudit.txt by the job given to queueWrite(job), which returns
+// false if the export queue is full.
+template <typename CreatureType, typename Audit, typename QueueWrite, typename Reply>
+bool AuditCreatureNavMesh(CreatureRegistryFeed<CreatureType>& feed, uint32_t mapID, std::optional<float> maxOffset, bool isNavMeshLoaded,
+    size_t workerCount, Audit&& audit, QueueWrite&& queueWrite, Reply&& reply)
+{
+    float offsetLimit = maxOffset ? *maxOffset : 2.0f;
+    if (offsetLimit < 0)
+    {
+        reply("The offset must not be negative");
+        return false;
+    }
+    if (!isNavMeshLoaded)
+    {
+        reply("No navmesh is loaded for map " + std::to_string(mapID));
+        return false;
+    }
+
+    std::vector<NavAuditSpawn> spawns;
+    CreatureRegistry& registry = feed.GetRegistry();
+    spawns.reserve(registry.CountInMap(mapID));
+    registry.ForEachInMap(mapID, [&spawns](Creature* creature, CreatureReference const& creatureReference)
+    {
+        CreatureType* spawnCreature = creature;
+        spawns.push_back({ creatureReference.SpawnID, creatureReference.Entry, spawnCreature->GetName(),
+            spawnCreature->GetPositionX(), spawnCreature->GetPositionY(), spawnCreature->GetPositionZ() });
+    });
+    if (spawns.empty())
+    {
+        reply("No creatures are registered on map " + std::to_string(mapID));
+        return true;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<NavAuditResult> results(spawns.size());
+    bool isReachabilityChecked = audit(spawns, results);
+    auto elapsedMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+    if (!isReachabilityChecked)
+        reply("You are not on the navmesh, so reachability is not checked");
+    reply("Audited " + std::to_string(spawns.size()) + " spawns in " + std::to_string(elapsedMilliseconds) + " ms on "
+        + std::to_string(workerCount) + " threads");
+
+    // Only the sorting and the file are left, so hand them to the writer thread
+    std::function<std::string()> writeJob = [mapID, offsetLimit, isReachabilityChecked, spawns = std::move(spawns), results = std::move(results)]()
+    {
+        NavAuditSummary summary;
+        std::string report = FormatNavAuditReport(mapID, spawns, results, offsetLimit, isReachabilityChecked, summary);
+        std::string fileName = ConvertNumberToString(mapID) + ".navaudit.txt";
+        std::ofstream outputFile(fileName.c_str());
+        outputFile << report;
+        outputFile.close();
+        return "Navmesh audit of map " + std::to_string(mapID) + ": " + std::to_string(summary.NoPolyCount) + " no poly, "
+            + std::to_string(summary.OffMeshCount) + " off mesh, " + std::to_string(summary.UnreachableCount) + " unreachable, "
+            + std::to_string(summary.FlaggedCount) + " of " + std::to_string(summary.SpawnCount) + " spawns written to " + fileName;
+    };
+    if (!queueWrite(std::move(writeJob)))
+    {
+        reply("Export queue is full, try again once the current exports finish");
+        return false;
+    }
+    return true;
+}
+
+#endif
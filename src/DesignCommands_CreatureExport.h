@@ -0,0 +1,393 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_CREATUREEXPORT_H
+#define DESIGNCOMMANDS_CREATUREEXPORT_H
+
+#include "DesignCommands_Format.h"
+#include "DesignCommands_OutputLog.h"
+#include "DesignCommands_WorldScale.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Creature fields copied on the world thread for the writer thread. The
+// position is in WoW units until UnscaleCreatureExportRows converts it on the
+// writer thread, orientation is left as is.
+class CreatureExportRow
+{
+public:
+    std::string Name;
+    std::string SubName;
+    uint32_t Entry;
+    uint32_t SpawnID;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+    float Orientation;
+};
+
+// <mapId>.creatures.bin is this header, RecordCount fixed-size records and
+// then a string table, all little endian. Records start right after the
+// header and can be indexed directly once the file is mapped. Names are
+// stored once per distinct string and are NUL terminated in the table,
+// with the offsets relative to the start of the string table.
+struct CreatureExportHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint32_t MapID;
+    uint32_t RecordCount;
+    uint32_t RecordSize;
+    uint32_t StringTableOffset;
+    uint32_t StringTableSize;
+    float WorldScale;
+};
+static_assert(sizeof(CreatureExportHeader) == 32, "CreatureExportHeader must stay packed");
+
+struct CreatureExportRecord
+{
+    uint32_t Entry;
+    uint32_t SpawnID;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+    float Orientation;
+    uint32_t NameOffset;
+    uint32_t NameLength;
+    uint32_t SubNameOffset;
+    uint32_t SubNameLength;
+};
+static_assert(sizeof(CreatureExportRecord) == 40, "CreatureExportRecord must stay packed");
+
+// Divides every row's position by the map's world scale in one batch
+inline void UnscaleCreatureExportRows(std::vector<CreatureExportRow>& exportRows, float worldScale)
+{
+    CoordinateBatch positions;
+    positions.Resize(exportRows.size());
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+    {
+        positions.X[rowIndex] = exportRows[rowIndex].PositionX;
+        positions.Y[rowIndex] = exportRows[rowIndex].PositionY;
+        positions.Z[rowIndex] = exportRows[rowIndex].PositionZ;
+    }
+    UnscaleCoordinateBatch(positions, worldScale, false);
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+    {
+        exportRows[rowIndex].PositionX = positions.X[rowIndex];
+        exportRows[rowIndex].PositionY = positions.Y[rowIndex];
+        exportRows[rowIndex].PositionZ = positions.Z[rowIndex];
+    }
+}
+
+// Writes the name,subname,z text rows, echoing each one to the output log if
+// row echo is on, and returns the bytes written
+inline size_t WriteCreatureTextExport(uint32_t mapID, std::vector<CreatureExportRow> const& exportRows, OutputLog& output)
+{
+    std::vector<float> roundedHeights(exportRows.size());
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+        roundedHeights[rowIndex] = exportRows[rowIndex].PositionZ;
+    RoundCoordinates(roundedHeights.data(), roundedHeights.size());
+
+    size_t byteCount = 0;
+    std::vector<std::string> outputLines;
+    outputLines.reserve(exportRows.size());
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+    {
+        CreatureExportRow const& exportRow = exportRows[rowIndex];
+        std::string outputLine;
+        outputLine.reserve(exportRow.Name.size() + exportRow.SubName.size() + RoundValBufferSize + 3);
+        outputLine += exportRow.Name;
+        outputLine += ',';
+        outputLine += exportRow.SubName;
+        outputLine += ',';
+        AppendFixedVal(outputLine, roundedHeights[rowIndex]);
+        outputLine += ',';
+        if (output.IsEchoingRows())
+            output.Write(outputLine);
+        byteCount += outputLine.size() + 1;
+        outputLines.push_back(std::move(outputLine));
+    }
+    OutputFile outputFile;
+    outputFile.WriteLines(ConvertNumberToString(mapID) + ".txt", outputLines);
+    return byteCount;
+}
+
+inline size_t WriteCreatureBinaryExport(uint32_t mapID, float worldScale, std::vector<CreatureExportRow> const& exportRows)
+{
+    std::vector<CreatureExportRecord> records;
+    records.reserve(exportRows.size());
+    std::string stringTable;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+    auto internString = [&](std::string const& text)
+    {
+        auto offsetIter = stringOffsets.find(text);
+        if (offsetIter != stringOffsets.end())
+            return offsetIter->second;
+        uint32_t offset = uint32_t(stringTable.size());
+        stringTable.append(text);
+        stringTable.push_back('\0');
+        stringOffsets.emplace(text, offset);
+        return offset;
+    };
+
+    for (CreatureExportRow const& exportRow : exportRows)
+    {
+        CreatureExportRecord record;
+        record.Entry = exportRow.Entry;
+        record.SpawnID = exportRow.SpawnID;
+        record.PositionX = exportRow.PositionX;
+        record.PositionY = exportRow.PositionY;
+        record.PositionZ = exportRow.PositionZ;
+        record.Orientation = exportRow.Orientation;
+        record.NameOffset = internString(exportRow.Name);
+        record.NameLength = uint32_t(exportRow.Name.size());
+        record.SubNameOffset = internString(exportRow.SubName);
+        record.SubNameLength = uint32_t(exportRow.SubName.size());
+        records.push_back(record);
+    }
+
+    CreatureExportHeader header;
+    std::copy_n("DCCR", 4, header.Magic);
+    header.Version = 1;
+    header.MapID = mapID;
+    header.RecordCount = uint32_t(records.size());
+    header.RecordSize = sizeof(CreatureExportRecord);
+    header.StringTableOffset = uint32_t(sizeof(header) + records.size() * sizeof(CreatureExportRecord));
+    header.StringTableSize = uint32_t(stringTable.size());
+    header.WorldScale = worldScale;
+
+    std::string fileName = ConvertNumberToString(mapID) + ".creatures.bin";
+    std::ofstream outputFile(fileName.c_str(), std::ios::binary);
+    outputFile.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    outputFile.write(reinterpret_cast<char const*>(records.data()), std::streamsize(records.size() * sizeof(CreatureExportRecord)));
+    outputFile.write(stringTable.data(), std::streamsize(stringTable.size()));
+    outputFile.close();
+    return header.StringTableOffset + stringTable.size();
+}
+
+inline std::string GetCreatureDeltaFileName(uint32_t mapID)
+{
+    return ConvertNumberToString(mapID) + ".delta.txt";
+}
+
+// Names in the delta are escaped so that a comma or line break in one cannot
+// split the line. Backslashes and commas get a backslash in front, and CR and
+// LF are written as \r and \n.
+inline void AppendDeltaField(std::string& output, std::string_view field)
+{
+    for (char character : field)
+    {
+        if (character == '\\' || character == ',')
+            output += '\\';
+        else if (character == '\n' || character == '\r')
+        {
+            output += '\\';
+            character = character == '\n' ? 'n' : 'r';
+        }
+        output += character;
+    }
+}
+
+// Splits a delta line at the commas that are not escaped and unescapes each field
+inline void SplitDeltaLine(std::string_view line, std::vector<std::string>& outFields)
+{
+    outFields.assign(1, std::string());
+    for (size_t position = 0; position < line.size(); ++position)
+    {
+        char character = line[position];
+        if (character == ',')
+            outFields.emplace_back();
+        else if (character == '\\' && position + 1 < line.size())
+        {
+            char escaped = line[++position];
+            outFields.back() += escaped == 'n' ? '\n' : escaped == 'r' ? '\r' : escaped;
+        }
+        else
+            outFields.back() += character;
+    }
+}
+
+// <mapId>.delta.txt holds the changes since the last binary export, one batch
+// per .zonecreatureswrite delta, applied in file order. A line is "-,spawnId"
+// for a creature that left the world, or spawnId,entry,name,subname,x,y,z,o
+// with the names escaped by AppendDeltaField and floats written exactly.
+// Creatures without a spawn ID (summons) have no key and only show up in
+// full exports.
+inline size_t AppendCreatureDeltaExport(uint32_t mapID, std::vector<uint32_t> const& removedSpawnIDs, std::vector<CreatureExportRow> const& changedRows)
+{
+    std::string outputText;
+    outputText.reserve(removedSpawnIDs.size() * 12 + changedRows.size() * 96);
+    for (uint32_t spawnID : removedSpawnIDs)
+    {
+        outputText += "-,";
+        outputText += ConvertNumberToString(spawnID);
+        outputText += '\n';
+    }
+    for (CreatureExportRow const& changedRow : changedRows)
+    {
+        outputText += ConvertNumberToString(changedRow.SpawnID);
+        outputText += ',';
+        outputText += ConvertNumberToString(changedRow.Entry);
+        outputText += ',';
+        AppendDeltaField(outputText, changedRow.Name);
+        outputText += ',';
+        AppendDeltaField(outputText, changedRow.SubName);
+        for (float value : { changedRow.PositionX, changedRow.PositionY, changedRow.PositionZ, changedRow.Orientation })
+        {
+            outputText += ',';
+            AppendExactFloat(outputText, value);
+        }
+        outputText += '\n';
+    }
+
+    std::ofstream outputFile(GetCreatureDeltaFileName(mapID).c_str(), std::ios::app);
+    outputFile << outputText;
+    outputFile.close();
+    return outputText.size();
+}
+
+inline bool ReadCreatureBinaryExport(std::string const& fileName, std::vector<CreatureExportRow>& outRows, float& outWorldScale)
+{
+    std::ifstream inputFile(fileName.c_str(), std::ios::binary);
+    CreatureExportHeader header;
+    if (!inputFile.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::string_view(header.Magic, 4) != "DCCR"
+        || header.Version != 1 || header.RecordSize != sizeof(CreatureExportRecord))
+        return false;
+    outWorldScale = header.WorldScale;
+
+    std::vector<CreatureExportRecord> records(header.RecordCount);
+    std::string stringTable(header.StringTableSize, '\0');
+    if (!inputFile.read(reinterpret_cast<char*>(records.data()), std::streamsize(records.size() * sizeof(CreatureExportRecord)))
+        || !inputFile.read(stringTable.data(), std::streamsize(stringTable.size())))
+        return false;
+
+    outRows.reserve(outRows.size() + records.size());
+    for (CreatureExportRecord const& record : records)
+    {
+        if (uint64_t(record.NameOffset) + record.NameLength > stringTable.size() || uint64_t(record.SubNameOffset) + record.SubNameLength > stringTable.size())
+            return false;
+        outRows.push_back({ stringTable.substr(record.NameOffset, record.NameLength), stringTable.substr(record.SubNameOffset, record.SubNameLength),
+            record.Entry, record.SpawnID, record.PositionX, record.PositionY, record.PositionZ, record.Orientation });
+    }
+    return true;
+}
+
+// Folds <mapId>.delta.txt into <mapId>.creatures.bin, rewrites that and <mapId>.txt, and removes the delta
+inline std::string CompactCreatureExport(uint32_t mapID, OutputLog& output)
+{
+    std::string binaryFileName = ConvertNumberToString(mapID) + ".creatures.bin";
+    std::vector<CreatureExportRow> exportRows;
+    float worldScale;
+    if (!ReadCreatureBinaryExport(binaryFileName, exportRows, worldScale))
+        return "Could not read " + binaryFileName + ", run .zonecreatureswrite binary (or both) first";
+
+    std::unordered_map<uint32_t, size_t> rowBySpawnID;
+    rowBySpawnID.reserve(exportRows.size());
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+        if (exportRows[rowIndex].SpawnID != 0)
+            rowBySpawnID[exportRows[rowIndex].SpawnID] = rowIndex;
+    std::vector<bool> isRowRemoved(exportRows.size(), false);
+
+    std::ifstream deltaFile(GetCreatureDeltaFileName(mapID).c_str());
+    std::string deltaLine;
+    std::vector<std::string> fields;
+    size_t changeCount = 0;
+    size_t badLineCount = 0;
+    while (std::getline(deltaFile, deltaLine))
+    {
+        if (deltaLine.empty())
+            continue;
+        SplitDeltaLine(deltaLine, fields);
+
+        auto parseNumber = [](std::string_view field, auto& outValue)
+        {
+            std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), outValue);
+            return result.ec == std::errc() && result.ptr == field.data() + field.size();
+        };
+
+        uint32_t spawnID = 0;
+        if (fields.size() == 2 && fields[0] == "-" && parseNumber(fields[1], spawnID))
+        {
+            auto rowIter = rowBySpawnID.find(spawnID);
+            if (rowIter != rowBySpawnID.end())
+            {
+                isRowRemoved[rowIter->second] = true;
+                rowBySpawnID.erase(rowIter);
+            }
+            changeCount++;
+            continue;
+        }
+
+        CreatureExportRow changedRow;
+        if (fields.size() != 8 || !parseNumber(fields[0], changedRow.SpawnID) || !parseNumber(fields[1], changedRow.Entry)
+            || !parseNumber(fields[4], changedRow.PositionX) || !parseNumber(fields[5], changedRow.PositionY)
+            || !parseNumber(fields[6], changedRow.PositionZ) || !parseNumber(fields[7], changedRow.Orientation))
+        {
+            badLineCount++;
+            continue;
+        }
+        changedRow.Name = std::move(fields[2]);
+        changedRow.SubName = std::move(fields[3]);
+
+        auto rowIter = rowBySpawnID.find(changedRow.SpawnID);
+        if (rowIter != rowBySpawnID.end())
+            exportRows[rowIter->second] = std::move(changedRow);
+        else
+        {
+            rowBySpawnID[changedRow.SpawnID] = exportRows.size();
+            exportRows.push_back(std::move(changedRow));
+            isRowRemoved.push_back(false);
+        }
+        changeCount++;
+    }
+    deltaFile.close();
+
+    std::vector<CreatureExportRow> compactedRows;
+    compactedRows.reserve(exportRows.size());
+    for (size_t rowIndex = 0; rowIndex < exportRows.size(); ++rowIndex)
+        if (!isRowRemoved[rowIndex])
+            compactedRows.push_back(std::move(exportRows[rowIndex]));
+
+    WriteCreatureBinaryExport(mapID, worldScale, compactedRows);
+    WriteCreatureTextExport(mapID, compactedRows, output);
+    std::remove(GetCreatureDeltaFileName(mapID).c_str());
+    std::string message = "Compacted " + std::to_string(changeCount) + " changes into " + std::to_string(compactedRows.size())
+        + " creatures for map " + std::to_string(mapID);
+    if (badLineCount > 0)
+        message += ", skipped " + std::to_string(badLineCount) + " unreadable delta lines";
+    return message;
+}
+
+// Copies the export fields of a creature. Works on anything with the
+// Creature accessors used here, so the bench can build rows from its stubs.
+template <typename CreatureType>
+CreatureExportRow MakeCreatureExportRow(CreatureType* creature, uint32_t entry)
+{
+    return { creature->GetName(), creature->GetCreatureTemplate()->SubName, entry, creature->GetSpawnId(),
+        creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), creature->GetOrientation() };
+}
+
+#endif
@@ -0,0 +1,496 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_CREATUREREGISTRY_H
+#define DESIGNCOMMANDS_CREATUREREGISTRY_H
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Creature;
+
+// Only fixed-size fields, so registering a creature never allocates per
+// creature. Names are the same for every spawn of an entry and are read from
+// the creature (its template) when rows are exported.
+class CreatureReference
+{
+public:
+    uint64_t GUID = 0;
+    uint32_t MapID = 0;
+    uint32_t InstanceID = 0;
+    uint32_t Entry = 0;
+    uint32_t SpawnID = 0;
+
+    // Position when the creature entered the world or was last moved, used
+    // for grid bucketing
+    float PositionX = 0;
+    float PositionY = 0;
+};
+static_assert(std::is_trivially_copyable_v<CreatureReference>, "CreatureReference must stay plain data");
+
+// Every creature currently in the world, split by map and then bucketed into
+// a uniform XY grid so that map and area queries only touch what they need.
+// A creature is identified by its map, instance and GUID, as the same GUID
+// can be live in several instances of a map at once. Entries are removed
+// when the creature leaves the world, and the slots are reused, so memory
+// follows the live creature count. Each map also keeps the
+// entries moved, and the spawn IDs removed, since the last
+// ClearChangesInMap, for delta exports. Entering the world is not a change
+// in itself, so a grid that unloads and loads again adds nothing to them.
+//
+// Each map stores its creatures densely as one array per field, so a scan of
+// a map reads only the fields it uses, front to back. Removal swaps the last
+// entry into the hole. Slots stay put for the life of an entry and only point
+// at where the creature currently sits in its map's arrays.
+//
+// The creature pointers handed to visitors are only live on the thread that
+// applies the spawn and despawn events, once it has applied all of them.
+// Debug builds assert that every call comes from the first thread to use the
+// registry, and CreatureRegistryFeed asserts that nothing is left to apply.
+class CreatureRegistry
+{
+public:
+    // Roughly an eighth of a map grid, small enough that a radius query
+    // around a player does not drag in half the zone
+    static constexpr float CellSize = 64.0f;
+
+    void AssertOwnerThread() const
+    {
+#ifndef NDEBUG
+        std::thread::id ownerID;
+        std::thread::id currentID = std::this_thread::get_id();
+        if (!ownerThread.compare_exchange_strong(ownerID, currentID))
+            assert(ownerID == currentID && "CreatureRegistry used off its owner thread");
+#endif
+    }
+
+    // Adding a creature that is already registered replaces the old entry,
+    // so a creature re-entering the world is never listed twice
+    void Add(Creature* creature, CreatureReference const& reference)
+    {
+        AssertOwnerThread();
+        Remove(reference.MapID, reference.InstanceID, reference.GUID);
+
+        uint32_t slotIndex;
+        if (freeSlots.empty())
+        {
+            slotIndex = uint32_t(slotGenerations.size());
+            slotGenerations.push_back(0);
+            slotMapIndexes.push_back(nullptr);
+            slotDensePositions.push_back(0);
+            slotIsChanged.push_back(0);
+        }
+        else
+        {
+            slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        MapIndex& mapIndex = mapIndexes[reference.MapID];
+        mapIndex.MapID = reference.MapID;
+        slotMapIndexes[slotIndex] = &mapIndex;
+        slotDensePositions[slotIndex] = uint32_t(mapIndex.Slots.size());
+        mapIndex.Slots.push_back(slotIndex);
+        mapIndex.Creatures.push_back(creature);
+        mapIndex.GUIDs.push_back(reference.GUID);
+        mapIndex.InstanceIDs.push_back(reference.InstanceID);
+        mapIndex.Entries.push_back(reference.Entry);
+        mapIndex.SpawnIDs.push_back(reference.SpawnID);
+        mapIndex.PositionXs.push_back(reference.PositionX);
+        mapIndex.PositionYs.push_back(reference.PositionY);
+        mapIndex.Cells[GetCellKey(GetCellCoord(reference.PositionX), GetCellCoord(reference.PositionY))].push_back(slotIndex);
+        slotByKey[{ reference.MapID, reference.InstanceID, reference.GUID }] = slotIndex;
+
+        // A spawn coming back into the world is no longer removed
+        if (reference.SpawnID != 0)
+        {
+            auto removedIter = removedSpawnIDsByMap.find(reference.MapID);
+            if (removedIter != removedSpawnIDsByMap.end())
+                removedIter->second.erase(reference.SpawnID);
+        }
+    }
+
+    bool Remove(uint32_t mapID, uint32_t instanceID, uint64_t guid)
+    {
+        AssertOwnerThread();
+        auto slotIter = slotByKey.find({ mapID, instanceID, guid });
+        if (slotIter == slotByKey.end())
+            return false;
+        uint32_t slotIndex = slotIter->second;
+        slotByKey.erase(slotIter);
+
+        MapIndex& mapIndex = *slotMapIndexes[slotIndex];
+        uint32_t densePosition = slotDensePositions[slotIndex];
+        if (mapIndex.SpawnIDs[densePosition] != 0)
+            removedSpawnIDsByMap[mapIndex.MapID].insert(mapIndex.SpawnIDs[densePosition]);
+
+        RemoveFromCell(mapIndex, GetCellKey(GetCellCoord(mapIndex.PositionXs[densePosition]), GetCellCoord(mapIndex.PositionYs[densePosition])), slotIndex);
+
+        // Swap-remove from every field array, fixing up the moved slot
+        uint32_t lastPosition = uint32_t(mapIndex.Slots.size() - 1);
+        if (densePosition != lastPosition)
+        {
+            mapIndex.Slots[densePosition] = mapIndex.Slots[lastPosition];
+            mapIndex.Creatures[densePosition] = mapIndex.Creatures[lastPosition];
+            mapIndex.GUIDs[densePosition] = mapIndex.GUIDs[lastPosition];
+            mapIndex.InstanceIDs[densePosition] = mapIndex.InstanceIDs[lastPosition];
+            mapIndex.Entries[densePosition] = mapIndex.Entries[lastPosition];
+            mapIndex.SpawnIDs[densePosition] = mapIndex.SpawnIDs[lastPosition];
+            mapIndex.PositionXs[densePosition] = mapIndex.PositionXs[lastPosition];
+            mapIndex.PositionYs[densePosition] = mapIndex.PositionYs[lastPosition];
+            slotDensePositions[mapIndex.Slots[densePosition]] = densePosition;
+        }
+        mapIndex.Slots.pop_back();
+        mapIndex.Creatures.pop_back();
+        mapIndex.GUIDs.pop_back();
+        mapIndex.InstanceIDs.pop_back();
+        mapIndex.Entries.pop_back();
+        mapIndex.SpawnIDs.pop_back();
+        mapIndex.PositionXs.pop_back();
+        mapIndex.PositionYs.pop_back();
+
+        if (mapIndex.Slots.empty())
+            mapIndexes.erase(mapIndex.MapID);
+
+        // The changed list may still hold this slot, the generation bump makes that entry stale
+        slotIsChanged[slotIndex] = 0;
+        slotMapIndexes[slotIndex] = nullptr;
+        slotGenerations[slotIndex]++;
+        freeSlots.push_back(slotIndex);
+        return true;
+    }
+
+    // For entries whose position was changed in place, such as by a fall or
+    // a snap. Moves the entry to the cell of its new position.
+    void MarkMoved(uint32_t mapID, uint32_t instanceID, uint64_t guid, float positionX, float positionY)
+    {
+        AssertOwnerThread();
+        auto slotIter = slotByKey.find({ mapID, instanceID, guid });
+        if (slotIter == slotByKey.end())
+            return;
+        uint32_t slotIndex = slotIter->second;
+        MapIndex& mapIndex = *slotMapIndexes[slotIndex];
+        uint32_t densePosition = slotDensePositions[slotIndex];
+        uint64_t oldCellKey = GetCellKey(GetCellCoord(mapIndex.PositionXs[densePosition]), GetCellCoord(mapIndex.PositionYs[densePosition]));
+        uint64_t newCellKey = GetCellKey(GetCellCoord(positionX), GetCellCoord(positionY));
+        if (oldCellKey != newCellKey)
+        {
+            RemoveFromCell(mapIndex, oldCellKey, slotIndex);
+            mapIndex.Cells[newCellKey].push_back(slotIndex);
+        }
+        mapIndex.PositionXs[densePosition] = positionX;
+        mapIndex.PositionYs[densePosition] = positionY;
+
+        if (slotIsChanged[slotIndex])
+            return;
+        slotIsChanged[slotIndex] = 1;
+        mapIndex.ChangedSlots.push_back({ slotIndex, slotGenerations[slotIndex] });
+    }
+
+    size_t CountChangedInMap(uint32_t mapID) const
+    {
+        AssertOwnerThread();
+        size_t changedCount = 0;
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter != mapIndexes.end())
+            for (SlotHandle changedHandle : mapIndexIter->second.ChangedSlots)
+                if (IsLiveChange(changedHandle))
+                    changedCount++;
+        return changedCount;
+    }
+
+    // Visits the entries changed since the last ClearChangesInMap and hands
+    // back the spawn IDs removed since then. Nothing is cleared here, so
+    // changes that could not be written yet are still there next time.
+    template <typename Visitor>
+    void ForEachChangeInMap(uint32_t mapID, Visitor&& visitor, std::vector<uint32_t>& outRemovedSpawnIDs) const
+    {
+        AssertOwnerThread();
+        auto removedIter = removedSpawnIDsByMap.find(mapID);
+        if (removedIter != removedSpawnIDsByMap.end())
+            outRemovedSpawnIDs.insert(outRemovedSpawnIDs.end(), removedIter->second.begin(), removedIter->second.end());
+
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return;
+        MapIndex const& mapIndex = mapIndexIter->second;
+        for (SlotHandle changedHandle : mapIndex.ChangedSlots)
+        {
+            if (!IsLiveChange(changedHandle))
+                continue;
+            uint32_t densePosition = slotDensePositions[changedHandle.Index];
+            visitor(mapIndex.Creatures[densePosition], MakeReference(mapIndex, densePosition));
+        }
+    }
+
+    // Once the changes are written, or after a full export, nothing before
+    // it is a change any more
+    void ClearChangesInMap(uint32_t mapID)
+    {
+        AssertOwnerThread();
+        removedSpawnIDsByMap.erase(mapID);
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return;
+        MapIndex& mapIndex = mapIndexIter->second;
+        for (SlotHandle changedHandle : mapIndex.ChangedSlots)
+            if (IsLiveChange(changedHandle))
+                slotIsChanged[changedHandle.Index] = 0;
+        mapIndex.ChangedSlots.clear();
+    }
+
+    size_t Count() const
+    {
+        AssertOwnerThread();
+        return slotByKey.size();
+    }
+
+    size_t CountInMap(uint32_t mapID) const
+    {
+        AssertOwnerThread();
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return 0;
+        return mapIndexIter->second.Slots.size();
+    }
+
+    std::vector<uint32_t> GetMapIDs() const
+    {
+        AssertOwnerThread();
+        std::vector<uint32_t> mapIDs;
+        mapIDs.reserve(mapIndexes.size());
+        for (auto const& mapIndex : mapIndexes)
+            mapIDs.push_back(mapIndex.first);
+        return mapIDs;
+    }
+
+    size_t SlotCapacity() const
+    {
+        AssertOwnerThread();
+        return slotGenerations.size();
+    }
+
+    // Visitors are called as visitor(Creature*, CreatureReference const&) for live entries only
+    template <typename Visitor>
+    void ForEachInMap(uint32_t mapID, Visitor&& visitor)
+    {
+        AssertOwnerThread();
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return;
+        MapIndex& mapIndex = mapIndexIter->second;
+        for (uint32_t densePosition = 0; densePosition < mapIndex.Slots.size(); ++densePosition)
+            visitor(mapIndex.Creatures[densePosition], MakeReference(mapIndex, densePosition));
+    }
+
+    // Only the creature pointers of a map, for scans that need nothing else
+    template <typename Visitor>
+    void ForEachCreatureInMap(uint32_t mapID, Visitor&& visitor)
+    {
+        AssertOwnerThread();
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return;
+        for (Creature* creature : mapIndexIter->second.Creatures)
+            visitor(creature);
+    }
+
+    template <typename Visitor>
+    void ForEachInBox(uint32_t mapID, float minX, float minY, float maxX, float maxY, Visitor&& visitor)
+    {
+        AssertOwnerThread();
+        auto mapIndexIter = mapIndexes.find(mapID);
+        if (mapIndexIter == mapIndexes.end())
+            return;
+        MapIndex& mapIndex = mapIndexIter->second;
+
+        int32_t minCellX = GetCellCoord(minX);
+        int32_t maxCellX = GetCellCoord(maxX);
+        int32_t minCellY = GetCellCoord(minY);
+        int32_t maxCellY = GetCellCoord(maxY);
+
+        // A huge box would visit more empty cells than there are creatures,
+        // so stream the position arrays instead
+        if (uint64_t(maxCellX - minCellX + 1) * uint64_t(maxCellY - minCellY + 1) > mapIndex.Cells.size())
+        {
+            for (uint32_t densePosition = 0; densePosition < mapIndex.Slots.size(); ++densePosition)
+                if (IsInBox(mapIndex.PositionXs[densePosition], mapIndex.PositionYs[densePosition], minX, minY, maxX, maxY))
+                    visitor(mapIndex.Creatures[densePosition], MakeReference(mapIndex, densePosition));
+            return;
+        }
+
+        for (int32_t cellX = minCellX; cellX <= maxCellX; ++cellX)
+        {
+            for (int32_t cellY = minCellY; cellY <= maxCellY; ++cellY)
+            {
+                auto cellIter = mapIndex.Cells.find(GetCellKey(cellX, cellY));
+                if (cellIter == mapIndex.Cells.end())
+                    continue;
+                for (uint32_t slotIndex : cellIter->second)
+                {
+                    uint32_t densePosition = slotDensePositions[slotIndex];
+                    if (IsInBox(mapIndex.PositionXs[densePosition], mapIndex.PositionYs[densePosition], minX, minY, maxX, maxY))
+                        visitor(mapIndex.Creatures[densePosition], MakeReference(mapIndex, densePosition));
+                }
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void ForEachInRadius(uint32_t mapID, float centerX, float centerY, float radius, Visitor&& visitor)
+    {
+        float radiusSquared = radius * radius;
+        ForEachInBox(mapID, centerX - radius, centerY - radius, centerX + radius, centerY + radius, [&](Creature* creature, CreatureReference const& reference)
+        {
+            float deltaX = reference.PositionX - centerX;
+            float deltaY = reference.PositionY - centerY;
+            if (deltaX * deltaX + deltaY * deltaY <= radiusSquared)
+                visitor(creature, reference);
+        });
+    }
+
+private:
+    // A slot plus the generation it had when the entry was marked changed, so
+    // a change to a despawned creature is not read from whatever reuses the slot
+    struct SlotHandle
+    {
+        uint32_t Index = 0;
+        uint32_t Generation = 0;
+    };
+
+    struct CreatureKey
+    {
+        uint32_t MapID = 0;
+        uint32_t InstanceID = 0;
+        uint64_t GUID = 0;
+
+        bool operator==(CreatureKey const& other) const
+        {
+            return MapID == other.MapID && InstanceID == other.InstanceID && GUID == other.GUID;
+        }
+    };
+
+    struct CreatureKeyHash
+    {
+        size_t operator()(CreatureKey const& key) const
+        {
+            return std::hash<uint64_t>()(key.GUID ^ (uint64_t(key.MapID) << 48) ^ (uint64_t(key.InstanceID) << 20));
+        }
+    };
+
+    // One map's creatures, one array per field, all indexed by dense position
+    struct MapIndex
+    {
+        uint32_t MapID = 0;
+        std::vector<uint32_t> Slots;
+        std::vector<Creature*> Creatures;
+        std::vector<uint64_t> GUIDs;
+        std::vector<uint32_t> InstanceIDs;
+        std::vector<uint32_t> Entries;
+        std::vector<uint32_t> SpawnIDs;
+        std::vector<float> PositionXs;
+        std::vector<float> PositionYs;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> Cells;
+        std::vector<SlotHandle> ChangedSlots;
+    };
+
+    static CreatureReference MakeReference(MapIndex const& mapIndex, uint32_t densePosition)
+    {
+        CreatureReference reference;
+        reference.GUID = mapIndex.GUIDs[densePosition];
+        reference.MapID = mapIndex.MapID;
+        reference.InstanceID = mapIndex.InstanceIDs[densePosition];
+        reference.Entry = mapIndex.Entries[densePosition];
+        reference.SpawnID = mapIndex.SpawnIDs[densePosition];
+        reference.PositionX = mapIndex.PositionXs[densePosition];
+        reference.PositionY = mapIndex.PositionYs[densePosition];
+        return reference;
+    }
+
+    // Far past any map edge, and small enough that a span of cells never
+    // overflows. Anything outside it, NaN included, is clamped.
+    static constexpr int32_t MaxCellCoord = 1 << 24;
+
+    static int32_t GetCellCoord(float value)
+    {
+        float cellCoord = std::floor(value / CellSize);
+        if (!(cellCoord > float(-MaxCellCoord)))
+            return -MaxCellCoord;
+        if (cellCoord > float(MaxCellCoord))
+            return MaxCellCoord;
+        return int32_t(cellCoord);
+    }
+
+    static uint64_t GetCellKey(int32_t cellX, int32_t cellY)
+    {
+        return (uint64_t(uint32_t(cellX)) << 32) | uint64_t(uint32_t(cellY));
+    }
+
+    static void RemoveFromCell(MapIndex& mapIndex, uint64_t cellKey, uint32_t slotIndex)
+    {
+        auto cellIter = mapIndex.Cells.find(cellKey);
+        if (cellIter == mapIndex.Cells.end())
+            return;
+        std::vector<uint32_t>& cellSlots = cellIter->second;
+        for (size_t i = 0; i < cellSlots.size(); ++i)
+        {
+            if (cellSlots[i] == slotIndex)
+            {
+                cellSlots[i] = cellSlots.back();
+                cellSlots.pop_back();
+                break;
+            }
+        }
+        if (cellSlots.empty())
+            mapIndex.Cells.erase(cellIter);
+    }
+
+    static bool IsInBox(float positionX, float positionY, float minX, float minY, float maxX, float maxY)
+    {
+        return positionX >= minX && positionX <= maxX && positionY >= minY && positionY <= maxY;
+    }
+
+    bool IsLiveChange(SlotHandle handle) const
+    {
+        return slotGenerations[handle.Index] == handle.Generation && slotIsChanged[handle.Index];
+    }
+
+    // Per slot
+    std::vector<uint32_t> slotGenerations;
+    std::vector<MapIndex*> slotMapIndexes;
+    std::vector<uint32_t> slotDensePositions;
+    std::vector<uint8_t> slotIsChanged;
+    std::vector<uint32_t> freeSlots;
+
+    std::unordered_map<CreatureKey, uint32_t, CreatureKeyHash> slotByKey;
+    std::unordered_map<uint32_t, MapIndex> mapIndexes;
+    std::unordered_map<uint32_t, std::unordered_set<uint32_t>> removedSpawnIDsByMap;
+
+#ifndef NDEBUG
+    mutable std::atomic<std::thread::id> ownerThread;
+#endif
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_EVENTQUEUE_H
+#define DESIGNCOMMANDS_EVENTQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Unbounded multi-producer, single-consumer queue (Vyukov's linked list
+// design). Push is one atomic exchange plus one store and never waits on
+// other producers or on the consumer. Only one thread may call Drain.
+template <typename T>
+class EventQueue
+{
+public:
+    EventQueue() : head(&stub), tail(&stub) {}
+
+    ~EventQueue()
+    {
+        Drain([](T&&) {});
+    }
+
+    EventQueue(EventQueue const&) = delete;
+    EventQueue& operator=(EventQueue const&) = delete;
+
+    void Push(T value)
+    {
+        Node* node = new Node(std::move(value));
+        Node* previousHead = head.exchange(node, std::memory_order_acq_rel);
+        previousHead->Next.store(node, std::memory_order_release);
+    }
+
+    // Hands every fully linked event to consumer(T&&) in push order, and
+    // returns how many were handed over. An event whose producer is between
+    // its two steps in Push is left for the next call.
+    template <typename Consumer>
+    size_t Drain(Consumer&& consumer)
+    {
+        size_t drainedCount = 0;
+        while (true)
+        {
+            Node* currentTail = tail;
+            Node* next = currentTail->Next.load(std::memory_order_acquire);
+            if (currentTail == &stub)
+            {
+                if (next == nullptr)
+                    return drainedCount;
+                tail = next;
+                currentTail = next;
+                next = next->Next.load(std::memory_order_acquire);
+            }
+
+            if (next != nullptr)
+            {
+                tail = next;
+                consumer(std::move(currentTail->Value));
+                delete currentTail;
+                drainedCount++;
+                continue;
+            }
+
+            // currentTail is the last node, put the stub back behind it so it can be taken
+            if (currentTail != head.load(std::memory_order_acquire))
+                return drainedCount;
+            stub.Next.store(nullptr, std::memory_order_relaxed);
+            Node* previousHead = head.exchange(&stub, std::memory_order_acq_rel);
+            previousHead->Next.store(&stub, std::memory_order_release);
+
+            next = currentTail->Next.load(std::memory_order_acquire);
+            if (next == nullptr)
+                return drainedCount;
+            tail = next;
+            consumer(std::move(currentTail->Value));
+            delete currentTail;
+            drainedCount++;
+        }
+    }
+
+    bool IsEmpty() const
+    {
+        return tail == &stub && stub.Next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        Node() = default;
+        explicit Node(T&& value) : Value(std::move(value)) {}
+
+        T Value{};
+        std::atomic<Node*> Next{ nullptr };
+    };
+
+    std::atomic<Node*> head;
+    Node* tail;
+    Node stub;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_FORMAT_H
+#define DESIGNCOMMANDS_FORMAT_H
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Longest float in fixed notation with six decimals is "-" + 39 digits + "." + 6
+constexpr size_t RoundValBufferSize = 48;
+
+// Snaps values within epsilon of zero to zero, and otherwise rounds to five
+// decimals. Output always carries six decimals, which the converter expects.
+inline float RoundValue(float value)
+{
+    float scale = 100000.0f;
+    if (value < std::numeric_limits<float>::epsilon() && value > -std::numeric_limits<float>::epsilon())
+        return 0;
+    return std::round((value + std::numeric_limits<float>::epsilon()) * scale) / scale;
+}
+
+// Writes the value with six decimals into the buffer with no terminator and
+// returns the length. The text matches what std::fixed and std::setprecision(6) give.
+inline size_t FormatFixedVal(char* buffer, size_t bufferSize, float value)
+{
+    std::to_chars_result result = std::to_chars(buffer, buffer + bufferSize, value, std::chars_format::fixed, 6);
+    if (result.ec != std::errc())
+        return 0;
+    return size_t(result.ptr - buffer);
+}
+
+inline size_t FormatRoundVal(char* buffer, size_t bufferSize, float value)
+{
+    return FormatFixedVal(buffer, bufferSize, RoundValue(value));
+}
+
+// Stack-held formatted value, for passing into fmt::format and logging
+class RoundValText
+{
+public:
+    explicit RoundValText(float value) : length(FormatRoundVal(buffer, sizeof(buffer), value)) {}
+
+    std::string_view View() const { return std::string_view(buffer, length); }
+
+private:
+    char buffer[RoundValBufferSize];
+    size_t length;
+};
+
+inline void AppendRoundVal(std::string& output, float value)
+{
+    char buffer[RoundValBufferSize];
+    output.append(buffer, FormatRoundVal(buffer, sizeof(buffer), value));
+}
+
+// For values already passed through RoundValue, which is not idempotent and
+// so must not be applied twice
+inline void AppendFixedVal(std::string& output, float value)
+{
+    char buffer[RoundValBufferSize];
+    output.append(buffer, FormatFixedVal(buffer, sizeof(buffer), value));
+}
+
+// Shortest text that reads back to the exact same float
+inline void AppendExactFloat(std::string& output, float value)
+{
+    char buffer[RoundValBufferSize];
+    std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    output.append(buffer, result.ec == std::errc() ? size_t(result.ptr - buffer) : 0);
+}
+
+// Appends "Xf, Yf, Zf"
+inline void AppendRoundVals(std::string& output, float valueX, float valueY, float valueZ)
+{
+    AppendRoundVal(output, valueX);
+    output += "f, ";
+    AppendRoundVal(output, valueY);
+    output += "f, ";
+    AppendRoundVal(output, valueZ);
+    output += 'f';
+}
+
+inline std::string RoundVal(float value, int /*places*/ = 6)
+{
+    return std::string(RoundValText(value).View());
+}
+
+// Appends one zoneProperties.AddZoneLineBox(...) line, newline included
+inline void AppendZoneLineBox(std::string& output, std::string const& targetZoneName, float targetX, float targetY, float targetZ,
+    std::string const& targetOrientation, float boxTopX, float boxTopY, float boxTopZ, float boxBottomX, float boxBottomY, float boxBottomZ)
+{
+    output.reserve(output.size() + targetZoneName.size() + targetOrientation.size() + 9 * (RoundValBufferSize + 3) + 48);
+    output += "zoneProperties.AddZoneLineBox(\"";
+    output += targetZoneName;
+    output += "\", ";
+    AppendRoundVals(output, targetX, targetY, targetZ);
+    output += ", ";
+    output += targetOrientation;
+    output += ", ";
+    AppendRoundVals(output, boxTopX, boxTopY, boxTopZ);
+    output += ", ";
+    AppendRoundVals(output, boxBottomX, boxBottomY, boxBottomZ);
+    output += "); \n";
+}
+
+// Pulls every integer or decimal number out of free text, in order. Numbers
+// are an optional '-', digits, and optionally '.' and more digits, so "1.5.2"
+// gives 1.5 and 2 and "-.5" gives 5. Values too large for a float are skipped.
+inline void ParseCoordinateValues(std::string_view inputText, std::vector<float>& outValues)
+{
+    auto isDigit = [](char character) { return character >= '0' && character <= '9'; };
+
+    char const* cursor = inputText.data();
+    char const* end = inputText.data() + inputText.size();
+    while (cursor < end)
+    {
+        char const* numberStart = cursor;
+        if (*cursor == '-' && cursor + 1 < end && isDigit(cursor[1]))
+            cursor++;
+        else if (!isDigit(*cursor))
+        {
+            cursor++;
+            continue;
+        }
+
+        while (cursor < end && isDigit(*cursor))
+            cursor++;
+        if (cursor + 1 < end && *cursor == '.' && isDigit(cursor[1]))
+        {
+            cursor++;
+            while (cursor < end && isDigit(*cursor))
+                cursor++;
+        }
+
+        float value;
+        std::from_chars_result result = std::from_chars(numberStart, cursor, value);
+        if (result.ec == std::errc())
+            outValues.push_back(value);
+    }
+}
+
+// Splits a pasted list on ';' and line breaks and parses each piece as one
+// coordinate tuple. Pieces without any numbers are dropped.
+inline void ParseCoordinateTuples(std::string_view inputText, std::vector<std::vector<float>>& outTuples)
+{
+    size_t tupleStart = 0;
+    while (tupleStart <= inputText.size())
+    {
+        size_t tupleEnd = inputText.find_first_of(";\r\n", tupleStart);
+        if (tupleEnd == std::string_view::npos)
+            tupleEnd = inputText.size();
+
+        std::vector<float> tupleValues;
+        ParseCoordinateValues(inputText.substr(tupleStart, tupleEnd - tupleStart), tupleValues);
+        if (!tupleValues.empty())
+            outTuples.push_back(std::move(tupleValues));
+        tupleStart = tupleEnd + 1;
+    }
+}
+
+inline std::string ConvertNumberToString(uint32_t number)
+{
+    std::stringstream stringStreamOutput;
+    stringStreamOutput << number;
+    return stringStreamOutput.str();
+}
+
+class OutputFile
+{
+public:
+    void WriteLines(std::string const& fileName, std::vector<std::string> const& textRows)
+    {
+        std::ofstream outputFile(fileName.c_str());
+        for (std::string const& text : textRows)
+        {
+            outputFile << text;
+            outputFile << "\n";
+        }
+        outputFile.close();
+    }
+};
+
+#endif
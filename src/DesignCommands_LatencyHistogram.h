@@ -0,0 +1,102 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_LATENCYHISTOGRAM_H
+#define DESIGNCOMMANDS_LATENCYHISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Log-linear histogram of microsecond timings. Each power of two is split
+// into four buckets, so a reported percentile is at most ~25% above the true
+// value, and recording is a handful of integer operations. Not thread safe.
+class LatencyHistogram
+{
+public:
+    static constexpr uint32_t SubBucketBits = 2;
+    static constexpr uint32_t SubBucketCount = 1 << SubBucketBits;
+    static constexpr uint32_t BucketCount = 64 * SubBucketCount;
+
+    void Record(uint64_t microseconds)
+    {
+        buckets[GetBucketIndex(microseconds)]++;
+        count++;
+        maxMicroseconds = std::max(maxMicroseconds, microseconds);
+    }
+
+    uint64_t Count() const
+    {
+        return count;
+    }
+
+    uint64_t Max() const
+    {
+        return maxMicroseconds;
+    }
+
+    // Upper bound of the bucket holding the given fraction (0.5 for p50) of samples
+    uint64_t Percentile(double fraction) const
+    {
+        if (count == 0)
+            return 0;
+        uint64_t targetCount = std::max<uint64_t>(1, uint64_t(fraction * double(count) + 0.5));
+        uint64_t seenCount = 0;
+        for (uint32_t bucketIndex = 0; bucketIndex < BucketCount; ++bucketIndex)
+        {
+            seenCount += buckets[bucketIndex];
+            if (seenCount >= targetCount)
+                return std::min(GetBucketUpperBound(bucketIndex), maxMicroseconds);
+        }
+        return maxMicroseconds;
+    }
+
+    void Reset()
+    {
+        buckets.fill(0);
+        count = 0;
+        maxMicroseconds = 0;
+    }
+
+private:
+    static uint32_t GetBucketIndex(uint64_t value)
+    {
+        if (value < SubBucketCount)
+            return uint32_t(value);
+        uint32_t highestBit = uint32_t(std::bit_width(value)) - 1;
+        uint32_t subBucket = uint32_t(value >> (highestBit - SubBucketBits)) & (SubBucketCount - 1);
+        return (highestBit - SubBucketBits + 1) * SubBucketCount + subBucket;
+    }
+
+    static uint64_t GetBucketUpperBound(uint32_t bucketIndex)
+    {
+        if (bucketIndex < SubBucketCount)
+            return bucketIndex;
+        uint32_t highestBit = bucketIndex / SubBucketCount + SubBucketBits - 1;
+        uint64_t subBucket = bucketIndex % SubBucketCount;
+        uint32_t shift = highestBit - SubBucketBits;
+        return ((SubBucketCount + subBucket + 1) << shift) - 1;
+    }
+
+    std::array<uint64_t, BucketCount> buckets = {};
+    uint64_t count = 0;
+    uint64_t maxMicroseconds = 0;
+};
+
+#endif
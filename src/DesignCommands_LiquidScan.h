@@ -0,0 +1,237 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_LIQUIDSCAN_H
+#define DESIGNCOMMANDS_LIQUIDSCAN_H
+
+#include "DesignCommands_Format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class LiquidPlane
+{
+public:
+    float nwCornerX;
+    float nwCornerY;
+    float topZ;
+    float seCornerX;
+    float seCornerY;
+    float bottomZ;
+    std::string slantType;
+
+    LiquidPlane() : nwCornerX(0), nwCornerY(0), topZ(0), seCornerX(0), seCornerY(0), bottomZ(0), slantType("NorthHighSouthLow") {}
+
+    void Reset()
+    {
+        nwCornerX = 0;
+        nwCornerY = 0;
+        topZ = 0;
+        seCornerX = 0;
+        seCornerY = 0;
+        bottomZ = 0;
+        slantType = "NorthHighSouthLow";
+    }
+
+    std::string ToString() const
+    {
+        std::string output = "zoneProperties.AddLiquidPlane(LiquidType.Water, \"t50_sbw1\", ";
+        for (float value : { nwCornerX, nwCornerY, seCornerX, seCornerY, topZ, bottomZ })
+        {
+            AppendRoundVal(output, value);
+            output += "f, ";
+        }
+        output += "LiquidSlantType.";
+        output += slantType;
+        output += ", 250f);";
+        return output;
+    }
+};
+
+// Ground and water samples on a regular grid, row-major with X along a row
+class LiquidScanGrid
+{
+public:
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    float MinX = 0;
+    float MinY = 0;
+    float Step = 1;
+    std::vector<float> GroundHeights;
+    std::vector<float> WaterLevels;
+};
+
+class LiquidScanSettings
+{
+public:
+    // Smallest area, in samples, that is turned into a plane
+    uint32_t MinSampleCount = 16;
+
+    // Neighbouring samples whose water levels differ by more than this are
+    // treated as separate bodies of water, such as a pool above a river
+    float MaxLevelStep = 1.0f;
+
+    // A total rise below this over the whole plane is written as flat
+    float FlatTolerance = 0.05f;
+};
+
+// Finds connected areas where the water level sits above the ground, and fits
+// each one with an axis-aligned plane. The plane covers the bounding box of
+// the area and slants along whichever axis the water level changes the most,
+// from a least squares fit of the level against X and Y.
+inline void ExtractLiquidPlanes(LiquidScanGrid const& grid, LiquidScanSettings const& settings, std::vector<LiquidPlane>& outPlanes)
+{
+    size_t sampleCount = size_t(grid.Width) * grid.Height;
+    auto isLiquid = [&grid](size_t sampleIndex)
+    {
+        float waterLevel = grid.WaterLevels[sampleIndex];
+        return waterLevel > -10000.0f && waterLevel > grid.GroundHeights[sampleIndex];
+    };
+
+    std::vector<uint8_t> isVisited(sampleCount, 0);
+    std::vector<size_t> pendingSamples;
+    std::vector<size_t> areaSamples;
+    for (size_t seedIndex = 0; seedIndex < sampleCount; ++seedIndex)
+    {
+        if (isVisited[seedIndex] || !isLiquid(seedIndex))
+            continue;
+
+        // Flood fill the area, four-connected
+        areaSamples.clear();
+        pendingSamples.push_back(seedIndex);
+        isVisited[seedIndex] = 1;
+        while (!pendingSamples.empty())
+        {
+            size_t sampleIndex = pendingSamples.back();
+            pendingSamples.pop_back();
+            areaSamples.push_back(sampleIndex);
+
+            size_t column = sampleIndex % grid.Width;
+            size_t row = sampleIndex / grid.Width;
+            size_t neighbours[4];
+            size_t neighbourCount = 0;
+            if (column > 0)
+                neighbours[neighbourCount++] = sampleIndex - 1;
+            if (column + 1 < grid.Width)
+                neighbours[neighbourCount++] = sampleIndex + 1;
+            if (row > 0)
+                neighbours[neighbourCount++] = sampleIndex - grid.Width;
+            if (row + 1 < grid.Height)
+                neighbours[neighbourCount++] = sampleIndex + grid.Width;
+            for (size_t i = 0; i < neighbourCount; ++i)
+            {
+                size_t neighbourIndex = neighbours[i];
+                if (isVisited[neighbourIndex] || !isLiquid(neighbourIndex))
+                    continue;
+                if (std::fabs(grid.WaterLevels[neighbourIndex] - grid.WaterLevels[sampleIndex]) > settings.MaxLevelStep)
+                    continue;
+                isVisited[neighbourIndex] = 1;
+                pendingSamples.push_back(neighbourIndex);
+            }
+        }
+        if (areaSamples.size() < settings.MinSampleCount)
+            continue;
+
+        // Bounds and level = a + b * x + c * y, in coordinates relative to the box centre
+        size_t minColumn = grid.Width, maxColumn = 0, minRow = grid.Height, maxRow = 0;
+        for (size_t sampleIndex : areaSamples)
+        {
+            minColumn = std::min(minColumn, sampleIndex % grid.Width);
+            maxColumn = std::max(maxColumn, sampleIndex % grid.Width);
+            minRow = std::min(minRow, sampleIndex / grid.Width);
+            maxRow = std::max(maxRow, sampleIndex / grid.Width);
+        }
+        double centerColumn = 0.5 * double(minColumn + maxColumn);
+        double centerRow = 0.5 * double(minRow + maxRow);
+
+        double sumL = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0, sumYY = 0, sumXL = 0, sumYL = 0;
+        for (size_t sampleIndex : areaSamples)
+        {
+            double x = double(sampleIndex % grid.Width) - centerColumn;
+            double y = double(sampleIndex / grid.Width) - centerRow;
+            double level = grid.WaterLevels[sampleIndex];
+            sumL += level;
+            sumX += x;
+            sumY += y;
+            sumXX += x * x;
+            sumXY += x * y;
+            sumYY += y * y;
+            sumXL += x * level;
+            sumYL += y * level;
+        }
+        double count = double(areaSamples.size());
+        double meanLevel = sumL / count;
+
+        // Solve the centred normal equations for the two slopes, per sample step
+        double covXX = sumXX - sumX * sumX / count;
+        double covXY = sumXY - sumX * sumY / count;
+        double covYY = sumYY - sumY * sumY / count;
+        double covXL = sumXL - sumX * sumL / count;
+        double covYL = sumYL - sumY * sumL / count;
+        double determinant = covXX * covYY - covXY * covXY;
+        double slopeX = 0, slopeY = 0;
+        if (std::fabs(determinant) > 1e-9)
+        {
+            slopeX = (covXL * covYY - covYL * covXY) / determinant;
+            slopeY = (covYL * covXX - covXL * covXY) / determinant;
+        }
+        else if (covXX > 1e-9)
+            slopeX = covXL / covXX;
+        else if (covYY > 1e-9)
+            slopeY = covYL / covYY;
+        double centerLevel = meanLevel - slopeX * (sumX / count) - slopeY * (sumY / count);
+
+        double halfSpanX = 0.5 * double(maxColumn - minColumn);
+        double halfSpanY = 0.5 * double(maxRow - minRow);
+        double riseX = std::fabs(slopeX) * 2.0 * halfSpanX;
+        double riseY = std::fabs(slopeY) * 2.0 * halfSpanY;
+
+        LiquidPlane plane;
+        float halfStep = 0.5f * grid.Step;
+        plane.nwCornerX = grid.MinX + float(maxColumn) * grid.Step + halfStep;
+        plane.nwCornerY = grid.MinY + float(maxRow) * grid.Step + halfStep;
+        plane.seCornerX = grid.MinX + float(minColumn) * grid.Step - halfStep;
+        plane.seCornerY = grid.MinY + float(minRow) * grid.Step - halfStep;
+        if (riseX < settings.FlatTolerance && riseY < settings.FlatTolerance)
+        {
+            // Same shape the walked capture gives on flat water
+            plane.topZ = float(centerLevel);
+            plane.bottomZ = float(centerLevel) - 0.001f;
+        }
+        else if (riseX >= riseY)
+        {
+            // X runs south to north
+            plane.slantType = slopeX > 0 ? "NorthHighSouthLow" : "SouthHighNorthLow";
+            plane.topZ = float(centerLevel + std::fabs(slopeX) * halfSpanX);
+            plane.bottomZ = float(centerLevel - std::fabs(slopeX) * halfSpanX);
+        }
+        else
+        {
+            // Y runs east to west
+            plane.slantType = slopeY > 0 ? "WestHighEastLow" : "EastHighWestLow";
+            plane.topZ = float(centerLevel + std::fabs(slopeY) * halfSpanY);
+            plane.bottomZ = float(centerLevel - std::fabs(slopeY) * halfSpanY);
+        }
+        outPlanes.push_back(std::move(plane));
+    }
+}
+
+#endif
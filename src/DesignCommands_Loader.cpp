@@ -1,10 +1,14 @@
 void AddDesignCommandsCommandScripts();
 void AddDesignCommandsAllCreatureScripts();
 void AddDesignCommandsPlayerScript();
+void AddDesignCommandsAllMapScript();
+void AddDesignCommandsWorldScript();
 
 void Addmod_designcommandsScripts()
 {
     AddDesignCommandsCommandScripts();
     AddDesignCommandsAllCreatureScripts();
     AddDesignCommandsPlayerScript();
+    AddDesignCommandsAllMapScript();
+    AddDesignCommandsWorldScript();
 }
@@ -0,0 +1,130 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_NAVAUDIT_H
+#define DESIGNCOMMANDS_NAVAUDIT_H
+
+#include "DesignCommands_Format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Creature position and identity copied for a navmesh audit
+class NavAuditSpawn
+{
+public:
+    uint32_t SpawnID;
+    uint32_t Entry;
+    std::string Name;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+};
+
+// What the navmesh query found for one spawn. Distance is from the spawn to
+// the nearest point on the nearest poly, and only means something with HasPoly.
+class NavAuditResult
+{
+public:
+    bool HasPoly = false;
+    bool IsReachable = true;
+    float Distance = 0;
+};
+
+class NavAuditSummary
+{
+public:
+    size_t SpawnCount = 0;
+    size_t NoPolyCount = 0;
+    size_t OffMeshCount = 0;
+    size_t UnreachableCount = 0;
+    size_t FlaggedCount = 0;
+};
+
+// Builds the report of spawns with no poly in range, further than maxOffset
+// from the mesh, or on a part of the mesh that cannot be walked to. Worst
+// first: no poly, then by distance to the mesh. One line per spawn:
+// spawnId,entry,name,x,y,z,distance,problems
+inline std::string FormatNavAuditReport(uint32_t mapID, std::vector<NavAuditSpawn> const& spawns, std::vector<NavAuditResult> const& results,
+    float maxOffset, bool isReachabilityChecked, NavAuditSummary& outSummary)
+{
+    outSummary = NavAuditSummary();
+    outSummary.SpawnCount = spawns.size();
+    std::vector<size_t> flaggedIndexes;
+    for (size_t spawnIndex = 0; spawnIndex < results.size(); ++spawnIndex)
+    {
+        NavAuditResult const& result = results[spawnIndex];
+        bool isOffMesh = result.HasPoly && result.Distance > maxOffset;
+        if (!result.HasPoly)
+            outSummary.NoPolyCount++;
+        if (isOffMesh)
+            outSummary.OffMeshCount++;
+        if (result.HasPoly && !result.IsReachable)
+            outSummary.UnreachableCount++;
+        if (!result.HasPoly || isOffMesh || !result.IsReachable)
+            flaggedIndexes.push_back(spawnIndex);
+    }
+    outSummary.FlaggedCount = flaggedIndexes.size();
+
+    std::stable_sort(flaggedIndexes.begin(), flaggedIndexes.end(), [&results](size_t left, size_t right)
+    {
+        if (results[left].HasPoly != results[right].HasPoly)
+            return !results[left].HasPoly;
+        return results[left].Distance > results[right].Distance;
+    });
+
+    std::string report = "# Navmesh audit of map " + std::to_string(mapID) + ", " + std::to_string(outSummary.FlaggedCount) + " of "
+        + std::to_string(outSummary.SpawnCount) + " spawns flagged, off mesh beyond ";
+    AppendRoundVal(report, maxOffset);
+    report += isReachabilityChecked ? " yards, reachability from the requester's position\n" : " yards, reachability not checked\n";
+    report += "# spawnId,entry,name,x,y,z,distance,problems\n";
+    report.reserve(report.size() + flaggedIndexes.size() * 96);
+    for (size_t spawnIndex : flaggedIndexes)
+    {
+        NavAuditSpawn const& spawn = spawns[spawnIndex];
+        NavAuditResult const& result = results[spawnIndex];
+        report += ConvertNumberToString(spawn.SpawnID);
+        report += ',';
+        report += ConvertNumberToString(spawn.Entry);
+        report += ',';
+        report += spawn.Name;
+        report += ',';
+        for (float value : { spawn.PositionX, spawn.PositionY, spawn.PositionZ })
+        {
+            AppendRoundVal(report, value);
+            report += ',';
+        }
+        if (result.HasPoly)
+            AppendRoundVal(report, result.Distance);
+        else
+            report += '-';
+        report += ',';
+        if (!result.HasPoly)
+            report += "no poly";
+        else if (result.Distance > maxOffset)
+            report += result.IsReachable ? "off mesh" : "off mesh, unreachable";
+        else
+            report += "unreachable";
+        report += '\n';
+    }
+    return report;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_OUTPUTLOG_H
+#define DESIGNCOMMANDS_OUTPUTLOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Output channel for capture and export text. Lines go into a fixed size ring
+// and a thread of its own hands them to the sink in batches, joined into one
+// block per flush, so that a large dump costs the caller a lock and a move per
+// line instead of a log write. When the ring is full, Write drops new lines
+// and counts them, and the count is reported with the next batch.
+// WriteOrWait waits for room instead, for output that is the point of the
+// command. Safe to write from any thread.
+class OutputLog
+{
+public:
+    OutputLog() : lines(DefaultCapacity) {}
+
+    ~OutputLog()
+    {
+        Stop();
+    }
+
+    OutputLog(OutputLog const&) = delete;
+    OutputLog& operator=(OutputLog const&) = delete;
+
+    static constexpr size_t DefaultCapacity = 16384;
+
+    // Lines already queued are kept, up to the new capacity
+    void Configure(size_t capacity, uint32_t flushMilliseconds, bool isEchoingRows, std::function<void(std::string const&)> sink)
+    {
+        std::lock_guard<std::mutex> lock(lineMutex);
+        if (capacity == 0)
+            capacity = DefaultCapacity;
+        if (capacity != lines.size())
+        {
+            std::vector<std::string> resizedLines(capacity);
+            size_t keptCount = 0;
+            for (; keptCount < lineCount && keptCount < capacity; ++keptCount)
+                resizedLines[keptCount] = std::move(lines[(firstLine + keptCount) % lines.size()]);
+            droppedCount += lineCount - keptCount;
+            lines = std::move(resizedLines);
+            firstLine = 0;
+            lineCount = keptCount;
+        }
+        flushInterval = std::chrono::milliseconds(flushMilliseconds == 0 ? 1 : flushMilliseconds);
+        echoRows.store(isEchoingRows, std::memory_order_relaxed);
+        flushSink = std::move(sink);
+    }
+
+    void Write(std::string line)
+    {
+        std::lock_guard<std::mutex> lock(lineMutex);
+        if (isStopping || !flushSink)
+            return;
+        if (lineCount == lines.size())
+        {
+            droppedCount++;
+            return;
+        }
+        PushLine(std::move(line));
+    }
+
+    // Never drops the line. With the ring full, wakes the flush thread and
+    // blocks until it has taken the queued lines.
+    void WriteOrWait(std::string line)
+    {
+        std::unique_lock<std::mutex> lock(lineMutex);
+        if (!flushThread.joinable() && !isStopping && flushSink)
+            flushThread = std::thread(&OutputLog::Run, this);
+        while (lineCount == lines.size() && !isStopping)
+        {
+            flushCondition.notify_one();
+            spaceCondition.wait(lock);
+        }
+        if (isStopping || !flushSink)
+            return;
+        PushLine(std::move(line));
+    }
+
+    // Whether to write one line per item of a dump (creature rows, planes),
+    // checked by the caller so a skipped row is never formatted
+    bool IsEchoingRows() const
+    {
+        return echoRows.load(std::memory_order_relaxed);
+    }
+
+    // Flushes whatever is queued, then joins the thread
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(lineMutex);
+            isStopping = true;
+            flushCondition.notify_one();
+        }
+        if (flushThread.joinable())
+            flushThread.join();
+    }
+
+private:
+    // Called with lineMutex held and room in the ring
+    void PushLine(std::string line)
+    {
+        lines[(firstLine + lineCount) % lines.size()] = std::move(line);
+        lineCount++;
+        if (!flushThread.joinable())
+            flushThread = std::thread(&OutputLog::Run, this);
+        if (lineCount * 2 >= lines.size())
+            flushCondition.notify_one();
+    }
+
+    void Run()
+    {
+        std::vector<std::string> batch;
+        std::string block;
+        while (true)
+        {
+            size_t batchDroppedCount;
+            std::function<void(std::string const&)> sink;
+            bool isLastBatch;
+            {
+                std::unique_lock<std::mutex> lock(lineMutex);
+                flushCondition.wait_for(lock, flushInterval, [this] { return isStopping || lineCount * 2 >= lines.size(); });
+                for (; lineCount > 0; --lineCount)
+                {
+                    batch.push_back(std::move(lines[firstLine]));
+                    firstLine = (firstLine + 1) % lines.size();
+                }
+                batchDroppedCount = droppedCount;
+                droppedCount = 0;
+                sink = flushSink;
+                isLastBatch = isStopping;
+            }
+            spaceCondition.notify_all();
+
+            if (!batch.empty() || batchDroppedCount > 0)
+            {
+                block.clear();
+                for (std::string const& line : batch)
+                {
+                    if (!block.empty())
+                        block += '\n';
+                    block += line;
+                }
+                if (batchDroppedCount > 0)
+                {
+                    if (!block.empty())
+                        block += '\n';
+                    block += "(" + std::to_string(batchDroppedCount) + " lines dropped, the output buffer was full)";
+                }
+                sink(block);
+                batch.clear();
+            }
+            if (isLastBatch)
+                return;
+        }
+    }
+
+    mutable std::mutex lineMutex;
+    std::condition_variable flushCondition;
+    std::condition_variable spaceCondition;
+    std::vector<std::string> lines;
+    size_t firstLine = 0;
+    size_t lineCount = 0;
+    size_t droppedCount = 0;
+    std::chrono::milliseconds flushInterval{ 200 };
+    std::atomic<bool> echoRows{ true };
+    bool isStopping = false;
+    std::function<void(std::string const&)> flushSink;
+    std::thread flushThread;
+};
+
+#endif
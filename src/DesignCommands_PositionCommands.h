@@ -0,0 +1,226 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_POSITIONCOMMANDS_H
+#define DESIGNCOMMANDS_POSITIONCOMMANDS_H
+
+#include "DesignCommands_CaptureJournal.h"
+#include "DesignCommands_CaptureState.h"
+#include "DesignCommands_Format.h"
+#include "DesignCommands_OutputLog.h"
+#include "DesignCommands_WorldScale.h"
+#include "DesignCommands_ZoneLines.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The bodies of the commands that read or move positions, without the chat
+// side, so the bench can drive them. reply(std::string const&) shows a line
+// to the GM, and teleport(mapID, x, y, z, orientation) moves the GM and
+// returns false, having told the GM why, if it cannot.
+
+// Journals a capture the caller has already applied to the capture state
+inline void JournalCapture(CaptureJournal& journal, CaptureRecordType type, std::initializer_list<float> values = {}, std::string_view text = {})
+{
+    CaptureRecord record;
+    record.Type = type;
+    std::copy(values.begin(), values.end(), record.Values);
+    record.Text = text;
+    journal.Append(FormatCaptureRecord(record));
+}
+
+// Coordinate tuples pasted into .eqxyz in one go, walked one per command
+class EQSurveyList
+{
+public:
+    std::vector<std::vector<float>> CoordinateTuples;
+    uint32_t CurrentIndex = 0;
+};
+
+// Teleports to EQ "x y [z [mapID [orientation]]]", scaled into WoW units.
+// isValidCoord(mapID, x, y) checks the map and unscaled position, telling the
+// GM if they are not valid, and surfaceHeight(mapID, x, y) is the higher of
+// the ground and the water there, used when no Z is given.
+template <typename IsValidCoord, typename SurfaceHeight, typename Teleport>
+bool TeleportToEQCoordinates(std::vector<float> const& locationValues, uint32_t currentMapID, float currentOrientation,
+    WorldScaleTable const& worldScales, IsValidCoord&& isValidCoord, SurfaceHeight&& surfaceHeight, Teleport&& teleport)
+{
+    // X and Y are required
+    if (locationValues.size() < 2)
+        return false;
+
+    uint32_t mapID = locationValues.size() >= 4 ? uint32_t(locationValues[3]) : currentMapID;
+    float x = locationValues[0];
+    float y = locationValues[1];
+    if (!isValidCoord(mapID, x, y))
+        return false;
+
+    float z = locationValues.size() >= 3 ? locationValues[2] : surfaceHeight(mapID, x, y);
+    float orientation = locationValues.size() >= 5 ? locationValues[4] : currentOrientation;
+
+    float worldScale = worldScales.GetScale(mapID);
+    return teleport(mapID, x * worldScale, y * worldScale, z * worldScale, orientation);
+}
+
+// .eqxyz body. One tuple is a plain teleport, several are kept as the GM's
+// survey list and walked with .eqxyznext and .eqxyzprev, starting at the
+// first. goToTuple(tuple) teleports to one tuple, as TeleportToEQCoordinates.
+template <typename Reply, typename GoToTuple>
+bool RunEQXYZ(std::string_view args, std::unordered_map<uint64_t, EQSurveyList>& surveyLists, uint64_t playerGUID, Reply&& reply, GoToTuple&& goToTuple)
+{
+    std::vector<std::vector<float>> coordinateTuples;
+    ParseCoordinateTuples(args, coordinateTuples);
+    if (coordinateTuples.empty())
+        return false;
+    if (coordinateTuples.size() == 1)
+        return goToTuple(coordinateTuples[0]);
+
+    EQSurveyList& surveyList = surveyLists[playerGUID];
+    surveyList.CoordinateTuples = std::move(coordinateTuples);
+    surveyList.CurrentIndex = 0;
+    reply("Loaded " + std::to_string(surveyList.CoordinateTuples.size()) + " survey points, going to point 1");
+    return goToTuple(surveyList.CoordinateTuples[0]);
+}
+
+// .eqxyznext and .eqxyzprev body, step is 1 or -1
+template <typename Reply, typename GoToTuple>
+bool StepEQSurvey(std::unordered_map<uint64_t, EQSurveyList>& surveyLists, uint64_t playerGUID, int32_t step, Reply&& reply, GoToTuple&& goToTuple)
+{
+    auto surveyListIter = surveyLists.find(playerGUID);
+    if (surveyListIter == surveyLists.end())
+    {
+        reply("No survey list loaded, paste several ';' separated coordinates into .eqxyz first");
+        return false;
+    }
+
+    EQSurveyList& surveyList = surveyListIter->second;
+    int64_t nextIndex = int64_t(surveyList.CurrentIndex) + step;
+    std::string pointCountText = " of " + std::to_string(surveyList.CoordinateTuples.size());
+    if (nextIndex < 0 || nextIndex >= int64_t(surveyList.CoordinateTuples.size()))
+    {
+        reply("Already at survey point " + std::to_string(surveyList.CurrentIndex + 1) + pointCountText);
+        return false;
+    }
+
+    surveyList.CurrentIndex = uint32_t(nextIndex);
+    reply("Survey point " + std::to_string(surveyList.CurrentIndex + 1) + pointCountText);
+    return goToTuple(surveyList.CoordinateTuples[surveyList.CurrentIndex]);
+}
+
+// .dgps body. Records the position unscaled to EQ units, as
+// "x|y|z|orientation scale:worldScale", and shows it.
+template <typename Reply>
+void CaptureDGPSPoint(CaptureState& state, CaptureJournal& journal, OutputLog& output, float worldScale,
+    float x, float y, float z, float orientation, Reply&& reply)
+{
+    std::string pointText;
+    AppendRoundVal(pointText, x / worldScale);
+    pointText += '|';
+    AppendRoundVal(pointText, y / worldScale);
+    pointText += '|';
+    AppendRoundVal(pointText, z / worldScale);
+    pointText += '|';
+    AppendRoundVal(pointText, orientation);
+    pointText += " scale:";
+    AppendExactFloat(pointText, worldScale);
+
+    std::string shownText = ApplyDGPSPoint(state, pointText);
+    JournalCapture(journal, CAPTURE_DGPS_POINT, {}, pointText);
+    reply(shownText);
+    output.Write(shownText);
+}
+
+// .sgps body. Shows "spawnID|x|y|z" with the position unscaled to EQ units.
+template <typename Reply>
+void ReportSGPSPoint(OutputLog& output, uint32_t spawnID, float worldScale, float x, float y, float z, Reply&& reply)
+{
+    std::string text = std::to_string(spawnID);
+    text += '|';
+    AppendRoundVal(text, x / worldScale);
+    text += '|';
+    AppendRoundVal(text, y / worldScale);
+    text += '|';
+    AppendRoundVal(text, z / worldScale);
+    reply(text);
+    output.Write(text);
+}
+
+// .lpcapture body. Each call captures the next edge of the current liquid plane.
+template <typename Reply>
+void CaptureLiquidPlaneNode(CaptureState& state, CaptureJournal& journal, OutputLog& output, float x, float y, float z, Reply&& reply)
+{
+    auto show = [&output, &reply](std::string const& text)
+    {
+        output.Write(text);
+        reply(text);
+    };
+
+    LiquidPlaneStep capturedStep = ApplyLiquidPlaneNode(state, x, y, z);
+    JournalCapture(journal, CAPTURE_LIQUID_NODE, { x, y, z });
+    if (capturedStep == LiquidPlaneStep::STEP_0_SOUTH_HEIGHT)
+    {
+        show("Starting new liquid plane, begining with south and low");
+        show("Captured low height and south edge, next is west");
+    }
+    else if (capturedStep == LiquidPlaneStep::STEP_1_WEST)
+        show("Captured west, next is east");
+    else if (capturedStep == LiquidPlaneStep::STEP_2_EAST)
+        show("Captured east, next is north + height");
+    else if (capturedStep == LiquidPlaneStep::STEP_3_NORTH_HEIGHT)
+        show("Captured north and high height for current plane, south and low for next plane. Next is west.");
+}
+
+// .zlcapture body. Only the position is kept, the text is built by .zlwrite.
+template <typename Reply>
+bool CaptureZoneLine(CaptureState& state, CaptureJournal& journal, std::vector<ZoneLinePairDefinition> const& pairs,
+    float x, float y, float z, Reply&& reply)
+{
+    if (pairs.empty())
+    {
+        reply("No zone line pairs are loaded");
+        return false;
+    }
+
+    ZoneLinePairDefinition const& pair = pairs[state.SelectedZoneLinePair];
+    state.ZoneLineCaptures.push_back({ state.SelectedZoneLinePair, x, y, z, pair.Name });
+    JournalCapture(journal, CAPTURE_ZONE_LINE, { x, y, z }, pair.Name);
+    reply("Captured zone line " + std::to_string(state.ZoneLineCaptures.size()) + " for " + pair.Name);
+    return true;
+}
+
+// .zlstephigh body, 20 yards along X and 30 up from the position
+template <typename Teleport>
+bool StepZoneLineHigh(uint32_t mapID, float x, float y, float z, float orientation, Teleport&& teleport)
+{
+    return teleport(mapID, x + 20.0f, y, z + 30.0f, orientation);
+}
+
+// .zlsteplow body, 20 yards back along Y from the position
+template <typename Teleport>
+bool StepZoneLineLow(uint32_t mapID, float x, float y, float z, float orientation, Teleport&& teleport)
+{
+    return teleport(mapID, x, y - 20.0f, z, orientation);
+}
+
+#endif
@@ -0,0 +1,368 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_TERRAIN_H
+#define DESIGNCOMMANDS_TERRAIN_H
+
+#include "DesignCommands_LiquidScan.h"
+#include "DesignCommands_WorkerPool.h"
+#include "DesignCommands_WorldScale.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Terrain and creature work, written against the few engine calls it needs so
+// that it runs the same on the worldserver and against the bench stubs. A
+// TerrainMap is anything with Map's
+//     float GetHeight(float x, float y, float z, bool checkVMap, float maxSearchDist) const
+//     float GetWaterLevel(float x, float y) const
+// and a creature anything with GetPositionX/Y/Z, GetOrientation, GetSpawnId
+// and SetPosition(x, y, z, o).
+
+// Ground heights from Map::GetHeight keyed by a quantized (x, y, z band).
+// EQ spawns cluster tightly, so most step-up probes land in a cell that a
+// neighbour already probed. Only the result's validity and the logged value
+// depend on it, so the quantization error does not matter here.
+class GroundHeightCache
+{
+public:
+    static constexpr float CellSizeXY = 2.0f;
+    static constexpr float CellSizeZ = 2.5f;
+    static constexpr size_t MaxEntries = 1 << 16;
+
+    template <typename TerrainMap>
+    float GetHeight(TerrainMap* map, float x, float y, float z, uint64_t& hits, uint64_t& misses)
+    {
+        uint64_t key = GetKey(x, y, z);
+        auto heightIter = heights.find(key);
+        if (heightIter != heights.end())
+        {
+            hits++;
+            return heightIter->second;
+        }
+
+        misses++;
+        float height = map->GetHeight(x, y, z, true, 150);
+        if (heights.size() >= MaxEntries)
+            heights.clear();
+        heights.emplace(key, height);
+        return height;
+    }
+
+    size_t Size() const
+    {
+        return heights.size();
+    }
+
+private:
+    static uint64_t GetKey(float x, float y, float z)
+    {
+        // 21 bits per axis covers any map coordinate at this resolution
+        uint64_t cellX = uint64_t(int64_t(std::floor(x / CellSizeXY))) & 0x1FFFFF;
+        uint64_t cellY = uint64_t(int64_t(std::floor(y / CellSizeXY))) & 0x1FFFFF;
+        uint64_t cellZ = uint64_t(int64_t(std::floor(z / CellSizeZ))) & 0x1FFFFF;
+        return (cellX << 42) | (cellY << 21) | cellZ;
+    }
+
+    std::unordered_map<uint64_t, float> heights;
+};
+
+// Moves a creature that is below the terrain up in growing steps until the
+// probe finds ground under it, giving up after ten tries
+template <typename TerrainMap, typename CreatureType>
+void StepUpOutOfGround(TerrainMap* map, GroundHeightCache& heightCache, CreatureType* creature, uint64_t& hits, uint64_t& misses)
+{
+    bool isObjectInMap = false;
+    int maxStepUps = 10;
+    int curStep = 0;
+    while (isObjectInMap == false && curStep < maxStepUps)
+    {
+        float height = heightCache.GetHeight(map, creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), hits, misses);
+        if (height < -10000)
+        {
+            creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ() + 2.5 * curStep, creature->GetOrientation());
+        }
+        else
+            isObjectInMap = true;
+        curStep++;
+    }
+}
+
+// Where a snapped creature comes to rest: on the ground, or for one that can
+// swim, wherever it already is between the ground and the water surface. The
+// first probe starts a little above the feet and later ones rise in the same
+// steps as StepUpOutOfGround. Returns false if no ground was found. These are
+// exact probes and not cached, since the result becomes the spawn position.
+template <typename TerrainMap>
+bool ResolveGroundSnapZ(TerrainMap* map, float x, float y, float z, bool canSwim, float& outZ)
+{
+    float groundHeight = -100000.0f;
+    float probeRaise = 2.0f;
+    for (int curStep = 0; curStep < 10 && groundHeight < -10000; ++curStep)
+    {
+        probeRaise += 2.5f * curStep;
+        groundHeight = map->GetHeight(x, y, z + probeRaise, true, 150);
+    }
+    if (groundHeight < -10000)
+        return false;
+
+    outZ = groundHeight;
+    if (canSwim)
+    {
+        float waterLevel = map->GetWaterLevel(x, y);
+        if (waterLevel > groundHeight)
+            outZ = std::clamp(z, groundHeight, waterLevel);
+    }
+    return true;
+}
+
+// One creature moved by a ground snap, in WoW coordinates
+class GroundSnapRecord
+{
+public:
+    uint64_t GUID;
+    uint32_t SpawnID;
+    uint32_t Entry;
+    float PositionX;
+    float PositionY;
+    float OldZ;
+    float NewZ;
+};
+
+// Snaps a creature straight to its resolved Z with SetPosition, no fall or
+// spline. Returns true and fills outRecord if it moved, all but the GUID and
+// entry, which the caller knows from the registry.
+template <typename TerrainMap, typename CreatureType>
+bool SnapCreatureToGround(TerrainMap* map, CreatureType* creature, bool canSwim, GroundSnapRecord& outRecord)
+{
+    float snappedZ;
+    if (!ResolveGroundSnapZ(map, creature->GetPositionX(), creature->GetPositionY(), creature->GetPositionZ(), canSwim, snappedZ))
+        return false;
+    if (std::fabs(snappedZ - creature->GetPositionZ()) < 0.001f)
+        return false;
+
+    outRecord.SpawnID = creature->GetSpawnId();
+    outRecord.PositionX = creature->GetPositionX();
+    outRecord.PositionY = creature->GetPositionY();
+    outRecord.OldZ = creature->GetPositionZ();
+    outRecord.NewZ = snappedZ;
+    creature->SetPosition(creature->GetPositionX(), creature->GetPositionY(), snappedZ, creature->GetOrientation());
+    return true;
+}
+
+// Snaps since the last write, one record per creature. A creature snapped
+// twice keeps its first old Z and its latest new Z.
+class GroundSnapLog
+{
+public:
+    void Add(GroundSnapRecord const& record)
+    {
+        auto indexIter = recordIndexes.find(record.GUID);
+        if (indexIter == recordIndexes.end())
+        {
+            recordIndexes.emplace(record.GUID, records.size());
+            records.push_back(record);
+        }
+        else
+            records[indexIter->second].NewZ = record.NewZ;
+    }
+
+    size_t Size() const
+    {
+        return records.size();
+    }
+
+    std::vector<GroundSnapRecord> Take()
+    {
+        std::vector<GroundSnapRecord> takenRecords = std::move(records);
+        records.clear();
+        recordIndexes.clear();
+        return takenRecords;
+    }
+
+private:
+    std::vector<GroundSnapRecord> records;
+    std::unordered_map<uint64_t, size_t> recordIndexes;
+};
+
+// <mapId>.snaps.txt, a header line and then "spawnId,entry,x,y,oldZ,newZ,deltaZ"
+// per creature in EQ units, so the deltas can be applied to the converter's spawns
+inline std::string FormatGroundSnapReport(uint32_t mapID, float worldScale, std::vector<GroundSnapRecord> const& records)
+{
+    CoordinateBatch positions;
+    positions.Resize(records.size() * 2);
+    for (size_t recordIndex = 0; recordIndex < records.size(); ++recordIndex)
+    {
+        GroundSnapRecord const& record = records[recordIndex];
+        positions.X[recordIndex * 2] = record.PositionX;
+        positions.Y[recordIndex * 2] = record.PositionY;
+        positions.Z[recordIndex * 2] = record.OldZ;
+        positions.Z[recordIndex * 2 + 1] = record.NewZ;
+    }
+    UnscaleCoordinateBatch(positions, worldScale, false);
+
+    std::string output = "# Ground snaps for map " + ConvertNumberToString(mapID) + ", " + ConvertNumberToString(uint32_t(records.size())) + " creatures\n";
+    output.reserve(output.size() + records.size() * (6 * RoundValBufferSize + 24));
+    for (size_t recordIndex = 0; recordIndex < records.size(); ++recordIndex)
+    {
+        float oldZ = positions.Z[recordIndex * 2];
+        float newZ = positions.Z[recordIndex * 2 + 1];
+        output += ConvertNumberToString(records[recordIndex].SpawnID);
+        output += ',';
+        output += ConvertNumberToString(records[recordIndex].Entry);
+        output += ',';
+        AppendRoundVal(output, positions.X[recordIndex * 2]);
+        output += ',';
+        AppendRoundVal(output, positions.Y[recordIndex * 2]);
+        output += ',';
+        AppendRoundVal(output, oldZ);
+        output += ',';
+        AppendRoundVal(output, newZ);
+        output += ',';
+        AppendRoundVal(output, newZ - oldZ);
+        output += '\n';
+    }
+    return output;
+}
+
+// Fills a LiquidScanGrid a slice at a time, so that a large area is sampled
+// over several updates of the map that owns it. Rows are done in bands no
+// taller than a terrain grid. Map::GetHeight creates a grid's terrain on the
+// first lookup in it, so each band first looks once into every grid it
+// crosses, from the calling thread and a few per Step, and only then hands
+// its samples to the pool.
+class TerrainGridSampler
+{
+public:
+    static constexpr size_t SamplesPerSlice = 16 * 1024;
+
+    void Start(LiquidScanGrid&& startGrid, float startProbeHeight, float startTerrainGridSize)
+    {
+        grid = std::move(startGrid);
+        probeHeight = startProbeHeight;
+        terrainGridSize = startTerrainGridSize;
+        size_t sampleCount = size_t(grid.Width) * grid.Height;
+        grid.GroundHeights.assign(sampleCount, 0.0f);
+        grid.WaterLevels.assign(sampleCount, 0.0f);
+        rowsPerBand = std::max<size_t>(1, size_t(terrainGridSize / grid.Step));
+        nextSample = 0;
+        bandEndRow = 0;
+        StartBand();
+    }
+
+    // Returns true once every sample is filled. Does at least one grid lookup
+    // or slice per call, then stops at maxGridLookups lookups or
+    // maxMicroseconds, whichever comes first (0 for no limit).
+    template <typename TerrainMap>
+    bool Step(TerrainMap* map, WorkerPool& workerPool, uint32_t maxGridLookups, uint64_t maxMicroseconds)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        uint32_t gridLookupCount = 0;
+        while (!IsDone())
+        {
+            if (nextGridPoint < gridPoints.size())
+            {
+                if (maxGridLookups != 0 && gridLookupCount >= maxGridLookups)
+                    break;
+                map->GetHeight(gridPoints[nextGridPoint].first, gridPoints[nextGridPoint].second, probeHeight);
+                nextGridPoint++;
+                gridLookupCount++;
+            }
+            else
+            {
+                size_t bandEndSample = bandEndRow * grid.Width;
+                size_t sliceEndSample = std::min(bandEndSample, nextSample + SamplesPerSlice);
+                size_t sliceBeginSample = nextSample;
+                workerPool.ParallelFor(sliceEndSample - sliceBeginSample, 1024, [&](size_t begin, size_t end, size_t /*workerIndex*/)
+                {
+                    for (size_t sampleIndex = sliceBeginSample + begin; sampleIndex < sliceBeginSample + end; ++sampleIndex)
+                    {
+                        float x = grid.MinX + float(sampleIndex % grid.Width) * grid.Step;
+                        float y = grid.MinY + float(sampleIndex / grid.Width) * grid.Step;
+                        grid.GroundHeights[sampleIndex] = map->GetHeight(x, y, probeHeight);
+                        grid.WaterLevels[sampleIndex] = map->GetWaterLevel(x, y);
+                    }
+                });
+                nextSample = sliceEndSample;
+                if (nextSample == bandEndSample)
+                    StartBand();
+            }
+
+            auto elapsedMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+            if (maxMicroseconds != 0 && uint64_t(elapsedMicroseconds) >= maxMicroseconds)
+                break;
+        }
+        return IsDone();
+    }
+
+    bool IsDone() const
+    {
+        return nextSample == grid.GroundHeights.size();
+    }
+
+    size_t GetSampledCount() const
+    {
+        return nextSample;
+    }
+
+    LiquidScanGrid& GetGrid()
+    {
+        return grid;
+    }
+
+private:
+    // Points spaced at most a grid apart along both edges of the band, so that
+    // every grid the band crosses gets one of them
+    void StartBand()
+    {
+        gridPoints.clear();
+        nextGridPoint = 0;
+        size_t bandBeginRow = bandEndRow;
+        bandEndRow = std::min<size_t>(grid.Height, bandBeginRow + rowsPerBand);
+        if (bandBeginRow == bandEndRow)
+            return;
+        float maxX = grid.MinX + float(grid.Width - 1) * grid.Step;
+        for (size_t row : { bandBeginRow, bandEndRow - 1 })
+        {
+            float y = grid.MinY + float(row) * grid.Step;
+            for (float x = grid.MinX; ; x += terrainGridSize)
+            {
+                gridPoints.emplace_back(std::min(x, maxX), y);
+                if (x >= maxX)
+                    break;
+            }
+        }
+    }
+
+    LiquidScanGrid grid;
+    float probeHeight = 0;
+    float terrainGridSize = 1;
+    size_t rowsPerBand = 1;
+    size_t bandEndRow = 0;
+    size_t nextSample = 0;
+    std::vector<std::pair<float, float>> gridPoints;
+    size_t nextGridPoint = 0;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_WORKERPOOL_H
+#define DESIGNCOMMANDS_WORKERPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread count to use when none is configured
+inline size_t GetDefaultWorkerCount()
+{
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Long-lived threads for the bulk commands, started on first use and kept
+// until Stop or a change of thread count. ParallelFor runs
+// work(begin, end, workerIndex) over [0, itemCount) and returns once all of
+// it is done. Workers pull chunks of chunkSize items as they go, so uneven
+// items still balance out, and the calling thread is worker 0. The pool runs
+// one job at a time. A caller that finds it busy (the export writer and the
+// world thread can both use it) runs its whole job alone instead of waiting.
+class WorkerPool
+{
+public:
+    WorkerPool() = default;
+
+    ~WorkerPool()
+    {
+        Stop();
+    }
+
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    // Thread count including the caller. Waits for a running job to finish.
+    void Configure(size_t workerCount)
+    {
+        std::lock_guard<std::mutex> jobLock(jobMutex);
+        workerCount = std::max<size_t>(1, workerCount);
+        if (workerCount == configuredWorkerCount)
+            return;
+        StopThreads();
+        configuredWorkerCount = workerCount;
+    }
+
+    size_t GetWorkerCount() const
+    {
+        return configuredWorkerCount;
+    }
+
+    template <typename Work>
+    void ParallelFor(size_t itemCount, size_t chunkSize, Work&& work)
+    {
+        if (itemCount == 0)
+            return;
+        chunkSize = std::max<size_t>(1, chunkSize);
+
+        std::unique_lock<std::mutex> jobLock(jobMutex, std::try_to_lock);
+        if (!jobLock.owns_lock() || configuredWorkerCount == 1 || itemCount <= chunkSize)
+        {
+            work(size_t(0), itemCount, size_t(0));
+            return;
+        }
+
+        if (threads.empty())
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            isStopping = false;
+            for (size_t workerIndex = 1; workerIndex < configuredWorkerCount; ++workerIndex)
+                threads.emplace_back(&WorkerPool::Run, this, workerIndex);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            jobWork = std::ref(work);
+            jobItemCount = itemCount;
+            jobChunkSize = chunkSize;
+            nextItem.store(0, std::memory_order_relaxed);
+            busyWorkerCount = threads.size();
+            jobGeneration++;
+        }
+        startCondition.notify_all();
+
+        RunChunks(0);
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        doneCondition.wait(lock, [this] { return busyWorkerCount == 0; });
+        jobWork = nullptr;
+    }
+
+    // Waits for a running job, then joins the threads
+    void Stop()
+    {
+        std::lock_guard<std::mutex> jobLock(jobMutex);
+        StopThreads();
+    }
+
+private:
+    // jobMutex must be held
+    void StopThreads()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            isStopping = true;
+        }
+        startCondition.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+        threads.clear();
+    }
+
+    void RunChunks(size_t workerIndex)
+    {
+        while (true)
+        {
+            size_t begin = nextItem.fetch_add(jobChunkSize, std::memory_order_relaxed);
+            if (begin >= jobItemCount)
+                return;
+            jobWork(begin, std::min(begin + jobChunkSize, jobItemCount), workerIndex);
+        }
+    }
+
+    void Run(size_t workerIndex)
+    {
+        uint64_t seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                startCondition.wait(lock, [&] { return isStopping || jobGeneration != seenGeneration; });
+                if (isStopping)
+                    return;
+                seenGeneration = jobGeneration;
+            }
+
+            RunChunks(workerIndex);
+
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--busyWorkerCount == 0)
+                doneCondition.notify_one();
+        }
+    }
+
+    // Held by a caller for its whole job, and by Configure and Stop
+    std::mutex jobMutex;
+    size_t configuredWorkerCount = GetDefaultWorkerCount();
+    std::vector<std::thread> threads;
+
+    std::mutex stateMutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    std::function<void(size_t, size_t, size_t)> jobWork;
+    size_t jobItemCount = 0;
+    size_t jobChunkSize = 1;
+    std::atomic<size_t> nextItem{ 0 };
+    size_t busyWorkerCount = 0;
+    uint64_t jobGeneration = 0;
+    bool isStopping = false;
+};
+
+#endif
@@ -0,0 +1,231 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_WORLDSCALE_H
+#define DESIGNCOMMANDS_WORLDSCALE_H
+
+#include "DesignCommands_Format.h"
+
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// EQ positions are WoW positions divided by the world scale
+constexpr float DefaultWorldScale = 0.29f;
+
+// World scale per map, for converted zones that were built at a different
+// factor than the rest
+class WorldScaleTable
+{
+public:
+    float GetScale(uint32_t mapID) const
+    {
+        auto mapScale = mapScales.find(mapID);
+        return mapScale == mapScales.end() ? defaultScale : mapScale->second;
+    }
+
+    float GetDefaultScale() const
+    {
+        return defaultScale;
+    }
+
+    // Reads "mapId:scale" entries separated by ',' or spaces, such as
+    // "30:0.25, 489:0.3". On a bad entry nothing is changed and false is
+    // returned. Scales must be above zero.
+    bool Load(float newDefaultScale, std::string_view mapScaleText)
+    {
+        if (!(newDefaultScale > 0))
+            return false;
+
+        std::unordered_map<uint32_t, float> newMapScales;
+        size_t entryStart = 0;
+        while (entryStart < mapScaleText.size())
+        {
+            size_t entryEnd = mapScaleText.find_first_of(", ", entryStart);
+            if (entryEnd == std::string_view::npos)
+                entryEnd = mapScaleText.size();
+            std::string_view entry = mapScaleText.substr(entryStart, entryEnd - entryStart);
+            entryStart = entryEnd + 1;
+            if (entry.empty())
+                continue;
+
+            size_t separator = entry.find(':');
+            if (separator == std::string_view::npos)
+                return false;
+            uint32_t mapID;
+            float scale;
+            std::from_chars_result mapResult = std::from_chars(entry.data(), entry.data() + separator, mapID);
+            std::from_chars_result scaleResult = std::from_chars(entry.data() + separator + 1, entry.data() + entry.size(), scale);
+            if (mapResult.ec != std::errc() || mapResult.ptr != entry.data() + separator
+                || scaleResult.ec != std::errc() || scaleResult.ptr != entry.data() + entry.size() || !(scale > 0))
+                return false;
+            newMapScales[mapID] = scale;
+        }
+
+        defaultScale = newDefaultScale;
+        mapScales = std::move(newMapScales);
+        return true;
+    }
+
+private:
+    float defaultScale = DefaultWorldScale;
+    std::unordered_map<uint32_t, float> mapScales;
+};
+
+// Positions split into one array per axis, so the kernels below can run
+// straight down each one
+class CoordinateBatch
+{
+public:
+    std::vector<float> X;
+    std::vector<float> Y;
+    std::vector<float> Z;
+    std::vector<float> O;
+
+    void Resize(size_t count)
+    {
+        X.resize(count);
+        Y.resize(count);
+        Z.resize(count);
+        O.resize(count);
+    }
+
+    size_t Size() const
+    {
+        return X.size();
+    }
+};
+
+// The kernels below give bit for bit what the scalar code gives: a plain
+// multiply or divide per value, and RoundValue for the rounding. They use
+// AVX when the module is built for it, SSE2 on any other x86-64 build, and
+// a scalar loop elsewhere and for the tail of each array.
+
+// EQ to WoW, in place
+inline void ScaleCoordinates(float* values, size_t count, float scale)
+{
+    size_t index = 0;
+#if defined(__AVX__)
+    __m256 scales8 = _mm256_set1_ps(scale);
+    for (; index + 8 <= count; index += 8)
+        _mm256_storeu_ps(values + index, _mm256_mul_ps(_mm256_loadu_ps(values + index), scales8));
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 scales4 = _mm_set1_ps(scale);
+    for (; index + 4 <= count; index += 4)
+        _mm_storeu_ps(values + index, _mm_mul_ps(_mm_loadu_ps(values + index), scales4));
+#endif
+    for (; index < count; ++index)
+        values[index] *= scale;
+}
+
+// WoW to EQ, in place. This divides rather than multiplying by the
+// reciprocal, which would not round the same way.
+inline void UnscaleCoordinates(float* values, size_t count, float scale)
+{
+    size_t index = 0;
+#if defined(__AVX__)
+    __m256 scales8 = _mm256_set1_ps(scale);
+    for (; index + 8 <= count; index += 8)
+        _mm256_storeu_ps(values + index, _mm256_div_ps(_mm256_loadu_ps(values + index), scales8));
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 scales4 = _mm_set1_ps(scale);
+    for (; index + 4 <= count; index += 4)
+        _mm_storeu_ps(values + index, _mm_div_ps(_mm_loadu_ps(values + index), scales4));
+#endif
+    for (; index < count; ++index)
+        values[index] /= scale;
+}
+
+// RoundValue on every value, in place. std::round rounds halves away from
+// zero, which the SIMD rounding modes cannot do directly, so this truncates
+// and then steps out by one where the dropped fraction is a half or more.
+// The sign of the input is carried over so that -0.3 still gives -0.
+inline void RoundCoordinates(float* values, size_t count)
+{
+    float const epsilon = std::numeric_limits<float>::epsilon();
+    float const scale = 100000.0f;
+    size_t index = 0;
+#if defined(__AVX__)
+    __m256 const signMask8 = _mm256_set1_ps(-0.0f);
+    __m256 const epsilons8 = _mm256_set1_ps(epsilon);
+    __m256 const scales8 = _mm256_set1_ps(scale);
+    __m256 const halves8 = _mm256_set1_ps(0.5f);
+    __m256 const ones8 = _mm256_set1_ps(1.0f);
+    for (; index + 8 <= count; index += 8)
+    {
+        __m256 value = _mm256_loadu_ps(values + index);
+        __m256 isNearZero = _mm256_cmp_ps(_mm256_andnot_ps(signMask8, value), epsilons8, _CMP_LT_OQ);
+        __m256 scaled = _mm256_mul_ps(_mm256_add_ps(value, epsilons8), scales8);
+        __m256 sign = _mm256_and_ps(scaled, signMask8);
+        __m256 truncated = _mm256_round_ps(scaled, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256 isHalfOrMore = _mm256_cmp_ps(_mm256_andnot_ps(signMask8, _mm256_sub_ps(scaled, truncated)), halves8, _CMP_GE_OQ);
+        __m256 rounded = _mm256_add_ps(truncated, _mm256_and_ps(isHalfOrMore, _mm256_or_ps(ones8, sign)));
+        rounded = _mm256_div_ps(_mm256_or_ps(rounded, sign), scales8);
+        _mm256_storeu_ps(values + index, _mm256_andnot_ps(isNearZero, rounded));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 const signMask4 = _mm_set1_ps(-0.0f);
+    __m128 const epsilons4 = _mm_set1_ps(epsilon);
+    __m128 const scales4 = _mm_set1_ps(scale);
+    __m128 const halves4 = _mm_set1_ps(0.5f);
+    __m128 const ones4 = _mm_set1_ps(1.0f);
+    // At and above 2^23 every float is a whole number already
+    __m128 const wholeLimit4 = _mm_set1_ps(8388608.0f);
+    for (; index + 4 <= count; index += 4)
+    {
+        __m128 value = _mm_loadu_ps(values + index);
+        __m128 isNearZero = _mm_cmplt_ps(_mm_andnot_ps(signMask4, value), epsilons4);
+        __m128 scaled = _mm_mul_ps(_mm_add_ps(value, epsilons4), scales4);
+        __m128 sign = _mm_and_ps(scaled, signMask4);
+        __m128 isFractional = _mm_cmplt_ps(_mm_andnot_ps(signMask4, scaled), wholeLimit4);
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(scaled));
+        truncated = _mm_or_ps(_mm_and_ps(isFractional, truncated), _mm_andnot_ps(isFractional, scaled));
+        __m128 isHalfOrMore = _mm_cmpge_ps(_mm_andnot_ps(signMask4, _mm_sub_ps(scaled, truncated)), halves4);
+        __m128 rounded = _mm_add_ps(truncated, _mm_and_ps(isHalfOrMore, _mm_or_ps(ones4, sign)));
+        rounded = _mm_div_ps(_mm_or_ps(rounded, sign), scales4);
+        _mm_storeu_ps(values + index, _mm_andnot_ps(isNearZero, rounded));
+    }
+#endif
+    for (; index < count; ++index)
+        values[index] = RoundValue(values[index]);
+}
+
+// WoW to EQ for a whole batch. Orientation is not scaled, but is rounded
+// along with the rest when asked.
+inline void UnscaleCoordinateBatch(CoordinateBatch& batch, float scale, bool isRounding)
+{
+    size_t count = batch.Size();
+    UnscaleCoordinates(batch.X.data(), count, scale);
+    UnscaleCoordinates(batch.Y.data(), count, scale);
+    UnscaleCoordinates(batch.Z.data(), count, scale);
+    if (!isRounding)
+        return;
+    RoundCoordinates(batch.X.data(), count);
+    RoundCoordinates(batch.Y.data(), count);
+    RoundCoordinates(batch.Z.data(), count);
+    RoundCoordinates(batch.O.data(), count);
+}
+
+#endif
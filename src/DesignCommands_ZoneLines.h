@@ -0,0 +1,243 @@
+/*
+** Made by Nathan Handley https://github.com/NathanHandley
+** AzerothCore 2019 http://www.azerothcore.org/
+*
+* This program is free software; you can redistribute it and/or modify it
+* under the terms of the GNU Affero General Public License as published by the
+* Free Software Foundation; either version 3 of the License, or (at your
+* option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+* FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for
+* more details.
+*
+* You should have received a copy of the GNU General Public License along
+* with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DESIGNCOMMANDS_ZONELINES_H
+#define DESIGNCOMMANDS_ZONELINES_H
+
+#include "DesignCommands_Format.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One coordinate of a zone line definition, either absolute or an offset from
+// a base position. Written as "-310.75" or "~+20" ("~" alone is an offset of 0).
+class ZoneLineValue
+{
+public:
+    float Value = 0;
+    bool IsRelative = false;
+
+    float Resolve(float baseValue) const
+    {
+        return IsRelative ? baseValue + Value : Value;
+    }
+};
+
+class ZoneLineVector
+{
+public:
+    ZoneLineValue X;
+    ZoneLineValue Y;
+    ZoneLineValue Z;
+};
+
+// How one capture spot turns into the matching pair of zone line boxes. The
+// other zone target is relative to the capture position, this zone's box is
+// relative to the capture position, and the other zone's box is relative to
+// the other zone target.
+class ZoneLinePairDefinition
+{
+public:
+    std::string Name;
+    std::string ThisZoneName;
+    std::string ThisZonePortInOrientation;
+    std::string OtherZoneName;
+    std::string OtherZonePortInOrientation;
+    ZoneLineVector OtherZoneTarget;
+    ZoneLineVector ThisZoneBoxTop;
+    ZoneLineVector ThisZoneBoxBottom;
+    ZoneLineVector OtherZoneBoxTop;
+    ZoneLineVector OtherZoneBoxBottom;
+};
+
+// Pairs captured so far, one line each:
+// name, thisZone, thisPortIn, otherZone, otherPortIn, target xyz, this box top xyz,
+// this box bottom xyz, other box top xyz, other box bottom xyz
+constexpr char const* DefaultZoneLinePairTable =
+    // North Qeynos is to the south of the Qeynos Hills
+    "qeynos2_qeytoqrg, qeynos2, South, qeytoqrg, North, -310.758850, ~+0.439697, -7.843740, ~+50, ~+10, 200, ~+20, ~-10, -100, ~-20, ~+10, 0, ~-50, ~-10, 0\n"
+    // Other zone side was never measured for this pair
+    "oasis_nro, oasis, South, nro, North, 0, 0, 0, ~-20, ~+10, 300, ~+50, ~-10, -200, 0, 0, 0, 0, 0, 0\n"
+    // East Freeport is north of North Ro
+    "nro_freporte, nro, South, freporte, North, -1316.303711, ~-1033.602013, -55.968739, ~+50, ~+10, 200, ~+20, ~-10, -100, ~-20, ~+10, 200, ~-50, ~-10, -100\n"
+    // West Freeport and East Commons, an east/west example
+    "ecommons_freportw, ecommons, West, freportw, East, ~+0.772155, 791.873230, -27.999950, ~+10, ~-20, 200, ~-10, ~-50, -100, ~+10, ~+50, 200, ~-10, ~+20, -100\n";
+
+inline std::string_view TrimZoneLineField(std::string_view field)
+{
+    while (!field.empty() && (field.front() == ' ' || field.front() == '\t'))
+        field.remove_prefix(1);
+    while (!field.empty() && (field.back() == ' ' || field.back() == '\t' || field.back() == '\r'))
+        field.remove_suffix(1);
+    return field;
+}
+
+inline bool ParseZoneLineValue(std::string_view field, ZoneLineValue& outValue)
+{
+    outValue.IsRelative = !field.empty() && field.front() == '~';
+    if (outValue.IsRelative)
+        field.remove_prefix(1);
+    if (outValue.IsRelative && field.empty())
+    {
+        outValue.Value = 0;
+        return true;
+    }
+    if (!field.empty() && field.front() == '+')
+        field.remove_prefix(1);
+    std::from_chars_result result = std::from_chars(field.data(), field.data() + field.size(), outValue.Value);
+    return result.ec == std::errc() && result.ptr == field.data() + field.size();
+}
+
+// Reads a pair table in the format of DefaultZoneLinePairTable. Blank lines
+// and lines starting with '#' are skipped. Returns the 1-based number of the
+// first bad line, or 0 if every line was read.
+inline size_t ParseZoneLinePairTable(std::string_view tableText, std::vector<ZoneLinePairDefinition>& outPairs)
+{
+    constexpr size_t FieldCount = 20;
+    size_t lineNumber = 0;
+    size_t lineStart = 0;
+    while (lineStart < tableText.size())
+    {
+        size_t lineEnd = tableText.find('\n', lineStart);
+        if (lineEnd == std::string_view::npos)
+            lineEnd = tableText.size();
+        std::string_view line = TrimZoneLineField(tableText.substr(lineStart, lineEnd - lineStart));
+        lineStart = lineEnd + 1;
+        lineNumber++;
+        if (line.empty() || line.front() == '#')
+            continue;
+
+        std::string_view fields[FieldCount];
+        size_t fieldCount = 0;
+        size_t fieldStart = 0;
+        while (fieldCount < FieldCount)
+        {
+            size_t fieldEnd = line.find(',', fieldStart);
+            fields[fieldCount++] = TrimZoneLineField(line.substr(fieldStart, fieldEnd == std::string_view::npos ? std::string_view::npos : fieldEnd - fieldStart));
+            if (fieldEnd == std::string_view::npos)
+                break;
+            fieldStart = fieldEnd + 1;
+        }
+        if (fieldCount != FieldCount || line.find(',', fieldStart) != std::string_view::npos)
+            return lineNumber;
+
+        ZoneLinePairDefinition pair;
+        pair.Name = fields[0];
+        pair.ThisZoneName = fields[1];
+        pair.ThisZonePortInOrientation = "ZoneLineOrientationType." + std::string(fields[2]);
+        pair.OtherZoneName = fields[3];
+        pair.OtherZonePortInOrientation = "ZoneLineOrientationType." + std::string(fields[4]);
+        ZoneLineVector* vectors[] = { &pair.OtherZoneTarget, &pair.ThisZoneBoxTop, &pair.ThisZoneBoxBottom, &pair.OtherZoneBoxTop, &pair.OtherZoneBoxBottom };
+        for (size_t vectorIndex = 0; vectorIndex < 5; ++vectorIndex)
+        {
+            if (!ParseZoneLineValue(fields[5 + vectorIndex * 3], vectors[vectorIndex]->X)
+                || !ParseZoneLineValue(fields[6 + vectorIndex * 3], vectors[vectorIndex]->Y)
+                || !ParseZoneLineValue(fields[7 + vectorIndex * 3], vectors[vectorIndex]->Z))
+                return lineNumber;
+        }
+        outPairs.push_back(std::move(pair));
+    }
+    return 0;
+}
+
+// Raw capture positions, turned into text only when written. The pair name
+// is kept so that the capture finds its pair again after the table reloads.
+class ZoneLineCapture
+{
+public:
+    uint32_t PairIndex;
+    float PositionX;
+    float PositionY;
+    float PositionZ;
+    std::string PairName;
+};
+
+// Points each capture at the index its pair has in a reloaded table, and
+// drops the captures whose pair is no longer in it. Returns the drop count.
+inline size_t RemapZoneLineCaptures(std::vector<ZoneLinePairDefinition> const& pairs, std::vector<ZoneLineCapture>& captures)
+{
+    size_t keptCount = 0;
+    for (size_t captureIndex = 0; captureIndex < captures.size(); ++captureIndex)
+    {
+        ZoneLineCapture& capture = captures[captureIndex];
+        auto pairIter = std::find_if(pairs.begin(), pairs.end(), [&capture](ZoneLinePairDefinition const& pair) { return pair.Name == capture.PairName; });
+        if (pairIter == pairs.end())
+            continue;
+        capture.PairIndex = uint32_t(pairIter - pairs.begin());
+        if (keptCount != captureIndex)
+            captures[keptCount] = std::move(capture);
+        keptCount++;
+    }
+    size_t droppedCount = captures.size() - keptCount;
+    captures.resize(keptCount);
+    return droppedCount;
+}
+
+// Appends the line for this zone and the line for the other zone for one capture
+inline void AppendZoneLineCapture(ZoneLinePairDefinition const& pair, ZoneLineCapture const& capture, std::string& thisZoneOutput, std::string& otherZoneOutput)
+{
+    float otherZoneX = pair.OtherZoneTarget.X.Resolve(capture.PositionX);
+    float otherZoneY = pair.OtherZoneTarget.Y.Resolve(capture.PositionY);
+    float otherZoneZ = pair.OtherZoneTarget.Z.Resolve(capture.PositionZ);
+
+    AppendZoneLineBox(thisZoneOutput, pair.OtherZoneName, otherZoneX, otherZoneY, otherZoneZ, pair.OtherZonePortInOrientation,
+        pair.ThisZoneBoxTop.X.Resolve(capture.PositionX), pair.ThisZoneBoxTop.Y.Resolve(capture.PositionY), pair.ThisZoneBoxTop.Z.Resolve(capture.PositionZ),
+        pair.ThisZoneBoxBottom.X.Resolve(capture.PositionX), pair.ThisZoneBoxBottom.Y.Resolve(capture.PositionY), pair.ThisZoneBoxBottom.Z.Resolve(capture.PositionZ));
+
+    AppendZoneLineBox(otherZoneOutput, pair.ThisZoneName, capture.PositionX, capture.PositionY, capture.PositionZ, pair.ThisZonePortInOrientation,
+        pair.OtherZoneBoxTop.X.Resolve(otherZoneX), pair.OtherZoneBoxTop.Y.Resolve(otherZoneY), pair.OtherZoneBoxTop.Z.Resolve(otherZoneZ),
+        pair.OtherZoneBoxBottom.X.Resolve(otherZoneX), pair.OtherZoneBoxBottom.Y.Resolve(otherZoneY), pair.OtherZoneBoxBottom.Z.Resolve(otherZoneZ));
+}
+
+// Zone line text for one pair, this zone's lines and then the other zone's
+class ZoneLineBlock
+{
+public:
+    uint32_t PairIndex;
+    std::string ThisZoneLines;
+    std::string OtherZoneLines;
+};
+
+// Renders all captures in one pass, one block per pair in the order the pairs
+// were first captured
+inline void RenderZoneLineCaptures(std::vector<ZoneLinePairDefinition> const& pairs, std::vector<ZoneLineCapture> const& captures, std::vector<ZoneLineBlock>& outBlocks)
+{
+    for (ZoneLineCapture const& capture : captures)
+    {
+        if (capture.PairIndex >= pairs.size())
+            continue;
+        ZoneLineBlock* block = nullptr;
+        for (ZoneLineBlock& existingBlock : outBlocks)
+            if (existingBlock.PairIndex == capture.PairIndex)
+                block = &existingBlock;
+        if (block == nullptr)
+        {
+            outBlocks.push_back({ capture.PairIndex, std::string(), std::string() });
+            block = &outBlocks.back();
+            block->ThisZoneLines.reserve(captures.size() * 192);
+            block->OtherZoneLines.reserve(captures.size() * 192);
+        }
+        AppendZoneLineCapture(pairs[capture.PairIndex], capture, block->ThisZoneLines, block->OtherZoneLines);
+    }
+}
+
+#endif